@@ -0,0 +1,25 @@
+/*
+ * armadilloConfig.hpp
+ * Includes armadillo with the settings used throughout. Every file must
+ * include armadillo through here, so they all see the same settings
+ *
+ */
+#ifndef ARMADILLO_CONFIG_HPP
+#define ARMADILLO_CONFIG_HPP
+
+#include <cstddef>
+
+#define ARMA_DONT_PRINT_ERRORS
+
+#ifdef SEER_DEBUG
+// Armadillo allocates through these, so its allocations are counted along
+// with those of operator new. Defined in common.cpp
+void* countedMalloc(size_t size);
+void countedFree(void* ptr);
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION countedMalloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION countedFree
+#endif
+
+#include <armadillo>
+
+#endif
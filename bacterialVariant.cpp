@@ -0,0 +1,81 @@
+/*
+ * File: bacterialVariant.cpp
+ *
+ * Decoding of bacterial variants
+ *
+ */
+
+#include "bacterialVariant.hpp"
+
+// Set the y and maf from decoded variants
+BacterialVariant::BacterialVariant(const std::vector<uint8_t>& variant, const long int bact_line)
+   :_number_samples(variant.size()), _bact_line(bact_line), _y(planeWords(variant.size()), 0), _y_missing(planeWords(variant.size()), 0), _y_count(0), _maf(0), _missing(0), _null_ll(0)
+{
+   for (size_t i = 0; i < _number_samples; ++i)
+   {
+      if (variant[i] == 1)
+      {
+         setPlaneBit(_y, i);
+      }
+      // missing as ref
+      else if (variant[i] == genotype_missing)
+      {
+         setPlaneBit(_y_missing, i);
+      }
+   }
+
+   set_counts();
+}
+
+// Set the y and maf from already packed planes
+BacterialVariant::BacterialVariant(const uint64_t* y, const uint64_t* missing, const size_t num_samples, const long int bact_line)
+   :_number_samples(num_samples), _bact_line(bact_line), _y(y, y + planeWords(num_samples)), _y_missing(missing, missing + planeWords(num_samples)), _y_count(0), _maf(0), _missing(0), _null_ll(0)
+{
+   set_counts();
+}
+
+void BacterialVariant::set_counts()
+{
+   _y_count = popcountPlane(_y);
+   if (_number_samples > 0)
+   {
+      _maf = (double)_y_count/_number_samples;
+      _missing = (double)popcountPlane(_y_missing)/_number_samples;
+   }
+}
+
+// Unpack y to a vector of 0s and 1s, reusing its memory
+void BacterialVariant::get_y(arma::vec& y) const
+{
+   y.zeros(_number_samples);
+   for (size_t i = 0; i < _number_samples; ++i)
+   {
+      if (planeBit(_y, i))
+      {
+         y[i] = 1;
+      }
+   }
+}
+
+// Add covariates. The same matrix is shared by every variant
+void BacterialVariant::add_covar(const std::shared_ptr<const arma::mat>& covars)
+{
+   if (covars->n_rows != _number_samples)
+   {
+      throw std::runtime_error("covariates: sample size incorrect\n");
+   }
+
+   _covars = covars;
+}
+
+// Get covars
+const arma::mat& BacterialVariant::get_covars() const
+{
+   if (!_covars)
+   {
+      throw std::logic_error("Tried to access bacterial variant covars when they have not been set");
+   }
+
+   return *_covars;
+}
+
@@ -0,0 +1,75 @@
+/*
+ * bacterialVariant.hpp
+ * Header file for BacterialVariant class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <exception>
+
+// Armadillo/dlib headers
+#include "armadilloConfig.hpp"
+
+// Packed planes
+#include "genotypeKernels.hpp"
+
+// A decoded bacterial variant. The covariates and null log-likelihood are
+// added while the variants are loaded, after which it is only read
+class BacterialVariant
+{
+   public:
+      // Initialisation
+      BacterialVariant(const std::vector<uint8_t>& variant, const long int bact_line); // this is defined in bacterialVariant.cpp
+      BacterialVariant(const uint64_t* y, const uint64_t* missing, const size_t num_samples, const long int bact_line); // this is defined in bacterialVariant.cpp
+
+      // nonmodifying operations
+      long int line() const { return _bact_line; }
+      double maf() const { return _maf; }
+      double missing() const { return _missing; }
+      size_t size() const { return _number_samples; }
+      double null_ll() const { return _null_ll; }
+      const arma::vec& null_coefficients() const { return _null_coefficients; }
+      const arma::mat& null_inverse_information() const { return _null_inverse_information; }
+
+      // y is held packed, as one bit per sample
+      const bitPlane& y_plane() const { return _y; }
+      size_t y_count() const { return _y_count; }
+      void get_y(arma::vec& y) const; // this is defined in bacterialVariant.cpp
+
+      // Variants with the same pattern give the same result in every test.
+      // Missing samples are counted as 0, so are not part of the pattern
+      uint64_t pattern_hash() const { return hashPlane(_y); }
+      bool same_pattern(const BacterialVariant& other) const { return _y == other._y; }
+
+      bool covars_set() const { return static_cast<bool>(_covars); }
+      const arma::mat& get_covars() const; // this is defined in bacterialVariant.cpp
+
+      // Modifying operations, used while loading
+      void add_covar(const std::shared_ptr<const arma::mat>& covars); // this is defined in bacterialVariant.cpp
+      void null_ll(const double null_ll) { _null_ll = null_ll; }
+      void null_coefficients(const arma::vec& coefficients) { _null_coefficients = coefficients; }
+      void null_inverse_information(const arma::mat& inverse) { _null_inverse_information = inverse; }
+
+   private:
+      void set_counts();
+
+      size_t _number_samples;
+      long int _bact_line;
+
+      bitPlane _y;
+      bitPlane _y_missing;
+      size_t _y_count;
+      std::shared_ptr<const arma::mat> _covars;
+
+      double _maf;
+      double _missing;
+      double _null_ll;
+      arma::vec _null_coefficients;
+      arma::mat _null_inverse_information; // empty if the null fit failed
+};
+
@@ -0,0 +1,289 @@
+/*
+ * File: bacterialVariants.cpp
+ *
+ * Reads in and filters the bacterial variants, from either the csv or
+ * packed binary format
+ *
+ */
+
+#include "epistasis.hpp"
+
+// Checks the filters and finishes off a newly read bacterial variant.
+// Returns whether it should be kept
+static bool keepBacterialVariant(BacterialVariant& bact_in, const cmdOptions& parameters, const std::shared_ptr<const arma::mat>& mds)
+{
+   // Check MAF and missingness of this variant
+   if (bact_in.maf() > parameters.min_af && bact_in.maf() < parameters.max_af && bact_in.missing() < parameters.missing)
+   {
+      if (mds)
+      {
+         bact_in.add_covar(mds);
+      }
+
+      return true;
+   }
+
+   return false;
+}
+
+// Reads the bacterial variants, passing those which pass the filters to
+// emit in input order. Stops early if emit returns false. Returns the
+// number of lines read
+static long int parseBacterialVariants(const cmdOptions& parameters, const size_t num_samples, const std::shared_ptr<const arma::mat>& mds, const std::function<bool(const BacterialVariant&)>& emit)
+{
+   long int bact_line_nr = 1;
+   if (isGenotypeFile(parameters.bact_file))
+   {
+      GenotypeFile bacterial_file(parameters.bact_file);
+      if (bacterial_file.type() != bacterial_genotypes)
+      {
+         throw std::runtime_error(parameters.bact_file + " contains human, not bacterial, genotypes");
+      }
+      else if (bacterial_file.samples() != num_samples)
+      {
+         throw std::runtime_error("bacterial snps: sample size incorrect in " + parameters.bact_file);
+      }
+
+      for (size_t variant = 0; variant < bacterial_file.variants(); ++variant)
+      {
+         // Filter on the stored maf before touching the record
+         const variantInfo& info = bacterial_file.info(variant);
+         if (info.maf > parameters.min_af && info.maf < parameters.max_af && info.missing < parameters.missing)
+         {
+            BacterialVariant bact_in(bacterial_file.plane(variant, 0), bacterial_file.plane(variant, 1), num_samples, variant + 1);
+
+            if (keepBacterialVariant(bact_in, parameters, mds) && !emit(bact_in))
+            {
+               break;
+            }
+         }
+      }
+      bact_line_nr = bacterial_file.variants();
+   }
+   else
+   {
+      igzstream bacterial_file;
+      bacterial_file.open(parameters.bact_file.c_str());
+
+      // Decoded lines are held here, and reused for every line
+      std::string line_buffer;
+      std::vector<uint8_t> genotype_buffer(num_samples);
+      while (bacterial_file)
+      {
+         if (readCsvLine(bacterial_file, line_buffer))
+         {
+            decodeBacterialLine(line_buffer, bact_line_nr, num_samples, genotype_buffer);
+
+            BacterialVariant bact_in(genotype_buffer, bact_line_nr);
+
+            if (keepBacterialVariant(bact_in, parameters, mds) && !emit(bact_in))
+            {
+               break;
+            }
+
+            bact_line_nr++;
+         }
+         else
+         {
+            bact_line_nr--;
+            break;
+         }
+      }
+   }
+
+   return bact_line_nr;
+}
+
+// Fits the null models of a batch of variants across the pool
+static void fitNullModels(std::vector<BacterialVariant>::iterator first, std::vector<BacterialVariant>::iterator last, ThreadPool& pool)
+{
+   pool.parallel_for(last - first, 1,
+      [&](size_t start, size_t end, unsigned int thread_id)
+      {
+         for (size_t i = start; i < end; ++i)
+         {
+            set_null_ll(*(first + i));
+         }
+      });
+}
+
+// Reads the bacterial variants passing the filters, and fits their null
+// models. Variants with identical patterns are only kept once, in
+// all_bacteria. bact_lines lists every kept line, in input order, with the
+// pattern in all_bacteria it is tested as.
+// Reading and parsing runs on its own thread, handing over batches of
+// variants in input order, while the null models of earlier batches are
+// fitted by the pool. Returns the number of lines read
+long int readBacterialVariants(const cmdOptions& parameters, const size_t num_samples, const std::shared_ptr<const arma::mat>& mds, ThreadPool& pool, std::vector<BacterialVariant>& all_bacteria, std::vector<patternLine>& bact_lines)
+{
+   auto load_start = std::chrono::steady_clock::now();
+
+   // If set here will calculate logistic regression for all bacterial
+   // variants if covar provided.
+   // Alternative would be to do for only pairs passing chi-sq. Less
+   // efficient if many pairs passing.
+   // These fits are the same for every chunk of the same input, so can be
+   // cached between jobs. Nothing is fitted while loading if the cache
+   // looks usable
+   uint64_t cache_key = 0;
+   bool fit_while_loading = true;
+   if (!parameters.null_cache.empty())
+   {
+      cache_key = nullCacheKey(parameters);
+      fit_while_loading = !nullCacheMatches(parameters.null_cache, cache_key);
+   }
+
+   std::mutex batch_mutex;
+   std::condition_variable batch_ready;
+   std::deque<std::vector<BacterialVariant>> batches;
+   bool parse_finished = false;
+   bool parse_stop = false;
+   std::exception_ptr parse_error;
+   long int bact_line_nr = 0;
+   double parse_seconds = 0;
+
+   std::thread parser([&]()
+      {
+         auto parse_start = std::chrono::steady_clock::now();
+         std::vector<BacterialVariant> batch;
+         long int lines_read = 0;
+         try
+         {
+            lines_read = parseBacterialVariants(parameters, num_samples, mds,
+               [&](const BacterialVariant& bact_in)
+               {
+                  batch.push_back(bact_in);
+                  if (batch.size() == bacterial_batch_size)
+                  {
+                     {
+                        std::lock_guard<std::mutex> lock(batch_mutex);
+                        if (parse_stop)
+                        {
+                           return false;
+                        }
+                        batches.push_back(std::move(batch));
+                     }
+                     batch_ready.notify_one();
+                     batch = std::vector<BacterialVariant>();
+                  }
+                  return true;
+               });
+         }
+         catch (...)
+         {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            parse_error = std::current_exception();
+         }
+
+         {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            if (!batch.empty())
+            {
+               batches.push_back(std::move(batch));
+            }
+            bact_line_nr = lines_read;
+            parse_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+            parse_finished = true;
+         }
+         batch_ready.notify_one();
+      });
+
+   // Fit each batch as it arrives. They arrive in order, so new patterns are
+   // appended. pattern_index finds earlier variants with the same hash
+   std::unordered_multimap<uint64_t, size_t> pattern_index;
+   double fit_seconds = 0;
+   try
+   {
+      while (true)
+      {
+         std::vector<BacterialVariant> batch;
+         {
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            batch_ready.wait(lock, [&]{ return !batches.empty() || parse_finished; });
+            if (batches.empty())
+            {
+               break;
+            }
+            batch = std::move(batches.front());
+            batches.pop_front();
+         }
+
+         std::vector<BacterialVariant> new_patterns;
+         for (auto bact = batch.begin(); bact != batch.end(); ++bact)
+         {
+            long int line = bact->line();
+            uint64_t hash = bact->pattern_hash();
+            size_t pattern = all_bacteria.size() + new_patterns.size();
+
+            auto matches = pattern_index.equal_range(hash);
+            for (auto match = matches.first; match != matches.second; ++match)
+            {
+               const BacterialVariant& existing = match->second < all_bacteria.size() ? all_bacteria[match->second] : new_patterns[match->second - all_bacteria.size()];
+               if (bact->same_pattern(existing))
+               {
+                  pattern = match->second;
+                  break;
+               }
+            }
+
+            if (pattern == all_bacteria.size() + new_patterns.size())
+            {
+               pattern_index.emplace(hash, pattern);
+               new_patterns.push_back(std::move(*bact));
+            }
+            bact_lines.push_back(patternLine{line, pattern});
+         }
+
+         if (fit_while_loading)
+         {
+            auto fit_start = std::chrono::steady_clock::now();
+            fitNullModels(new_patterns.begin(), new_patterns.end(), pool);
+            fit_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - fit_start).count();
+         }
+         std::move(new_patterns.begin(), new_patterns.end(), std::back_inserter(all_bacteria));
+      }
+   }
+   catch (...)
+   {
+      {
+         std::lock_guard<std::mutex> lock(batch_mutex);
+         parse_stop = true;
+      }
+      parser.join();
+      throw;
+   }
+
+   parser.join();
+   if (parse_error)
+   {
+      std::rethrow_exception(parse_error);
+   }
+
+   if (!fit_while_loading)
+   {
+      if (readNullCache(parameters.null_cache, cache_key, all_bacteria))
+      {
+         std::cerr << "Read null models from " << parameters.null_cache << std::endl;
+      }
+      else
+      {
+         auto fit_start = std::chrono::steady_clock::now();
+         fitNullModels(all_bacteria.begin(), all_bacteria.end(), pool);
+         fit_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - fit_start).count();
+         fit_while_loading = true;
+      }
+   }
+
+   if (fit_while_loading && !parameters.null_cache.empty())
+   {
+      writeNullCache(parameters.null_cache, cache_key, all_bacteria);
+   }
+
+   std::cerr << "Bacterial variants: read and parsed in " << parse_seconds << "s, null models fitted in "
+             << fit_seconds << "s on " << pool.size() << " threads, " << std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count()
+             << "s in total" << std::endl;
+   std::cerr << "Bacterial variants: " << bact_lines.size() << " passing filters, " << all_bacteria.size() << " unique patterns ("
+             << (all_bacteria.empty() ? 1 : (double)bact_lines.size() / all_bacteria.size()) << "x compression)" << std::endl;
+
+   return bact_line_nr;
+}
@@ -0,0 +1,417 @@
+/*
+ * File: batchedRegression.cpp
+ *
+ * Logistic regression of many bacterial variants on the same human variant
+ * and covariates. Only y differs between these pairs, so Newton-Raphson
+ * iterations are done for the whole batch together, as matrix-matrix
+ * products over the shared design matrix
+ *
+ */
+
+#include "linkFunction.hpp" // includes epistasis.hpp
+
+// Products x_j % x_l of each pair of columns j <= l of the design matrix.
+// With these, the information matrices X'WX of every pair in the batch are
+// the columns of a single product with the weights
+static void designProducts(const arma::mat& x_design, arma::mat& x_products)
+{
+   size_t num_coefficients = x_design.n_cols;
+   x_products.set_size(x_design.n_rows, num_coefficients * (num_coefficients + 1) / 2);
+
+   size_t column = 0;
+   for (size_t j = 0; j < num_coefficients; ++j)
+   {
+      for (size_t l = j; l < num_coefficients; ++l)
+      {
+         x_products.col(column++) = x_design.col(j) % x_design.col(l);
+      }
+   }
+}
+
+// Unpacks a column of products into the symmetric matrix it came from
+static void unpackProducts(const double* packed, arma::mat& unpacked)
+{
+   size_t column = 0;
+   for (size_t j = 0; j < unpacked.n_rows; ++j)
+   {
+      for (size_t l = j; l < unpacked.n_cols; ++l)
+      {
+         unpacked(j,l) = packed[column];
+         unpacked(l,j) = packed[column];
+         column++;
+      }
+   }
+}
+
+// Packs a symmetric matrix V so that x_products * packed gives x_i' V x_i
+// for every sample. Off-diagonal terms appear twice in that sum
+static void packQuadraticForm(const arma::mat& V, double* packed)
+{
+   size_t column = 0;
+   for (size_t j = 0; j < V.n_rows; ++j)
+   {
+      for (size_t l = j; l < V.n_cols; ++l)
+      {
+         packed[column++] = j == l ? V(j,l) : 2 * V(j,l);
+      }
+   }
+}
+
+// Position in the information matrix of [1 | x | covars] of coefficient j
+// of the null model [1 | covars]
+static inline size_t fullIndex(const size_t j)
+{
+   return j == 0 ? 0 : j + 1;
+}
+
+// Inverts the information matrix of [1 | x | covars] at the start of a fit,
+// where b_x = 0 so the weights are those of the null fit. The null block
+// [1 | covars] is then the null model's information C, whose inverse was
+// kept by set_null_ll, and x adds one row and column to it. With
+// a = x'Wx, g = [1 | covars]'Wx and v = C^-1 g, the Schur complement is
+// s = a - g'v and
+//    var(b_x) = 1/s
+//    cov(b_x, b_null) = -v/s
+//    var(b_null) = C^-1 + vv'/s
+// Returns false if s is not positive
+static bool schurInverse(const arma::mat& information, const arma::mat& null_inverse, arma::vec& v, arma::mat& var_covar_mat)
+{
+   const size_t num_null = null_inverse.n_rows;
+   v.zeros(num_null);
+   double s = information(1,1);
+   for (size_t j = 0; j < num_null; ++j)
+   {
+      for (size_t l = 0; l < num_null; ++l)
+      {
+         v(j) += null_inverse(j,l) * information(fullIndex(l),1);
+      }
+   }
+   for (size_t j = 0; j < num_null; ++j)
+   {
+      s -= information(fullIndex(j),1) * v(j);
+   }
+   if (!(s > 0))
+   {
+      return false;
+   }
+
+   var_covar_mat.set_size(num_null + 1, num_null + 1);
+   var_covar_mat(1,1) = 1 / s;
+   for (size_t j = 0; j < num_null; ++j)
+   {
+      var_covar_mat(fullIndex(j),1) = -v(j) / s;
+      var_covar_mat(1,fullIndex(j)) = -v(j) / s;
+      for (size_t l = 0; l < num_null; ++l)
+      {
+         var_covar_mat(fullIndex(j),fullIndex(l)) = null_inverse(j,l) + v(j) * v(l) / s;
+      }
+   }
+
+   return true;
+}
+
+// Inverts the information matrix of a pair into var_covar_mat, which keeps
+// its memory between calls. Uses schurInverse if null_inverse is given.
+// Returns false if this fails
+static bool invertInformation(const arma::mat& information, const arma::mat* null_inverse, arma::vec& v, arma::mat& var_covar_mat)
+{
+   if (null_inverse != nullptr && schurInverse(information, *null_inverse, v, var_covar_mat))
+   {
+      return true;
+   }
+   if (inv_sympd(var_covar_mat, information))
+   {
+      return true;
+   }
+
+   var_covar_mat = inv_covar(information);
+   return var_covar_mat.n_elem > 0;
+}
+
+// Newton-Raphson iterations as in newtonRaphson for every column of y at
+// once, starting from the columns of b. Pairs are dropped from the batch
+// when they converge, by moving the last active column into their place, so
+// y and b are reordered. Pairs with null_inverses[k] set start from their
+// null fit, so their first inversion uses it. The outcome of pair k is left
+// in workspace.batch_fits[k].
+// Every buffer is kept in the workspace, so once warm this does not allocate
+// unless an inversion falls back to pinv
+static void batchedNewton(const arma::mat& x_design, const arma::mat& x_products, arma::mat& y, arma::mat& b, const std::vector<const arma::mat*>& null_inverses, const bool firth, fitWorkspace& workspace)
+{
+   size_t active = y.n_cols;
+
+   // Column a of y and b is pair order[a] of the batch, and is inverted
+   // into var_covar_mats[a]. These only grow
+   std::vector<size_t>& order = workspace.batch_order;
+   std::vector<char>& finished = workspace.batch_finished;
+   std::vector<arma::mat>& var_covar_mats = workspace.batch_var_covar_mats;
+   std::vector<batchFit>& fits = workspace.batch_fits;
+   order.resize(active);
+   finished.resize(active);
+   if (var_covar_mats.size() < active)
+   {
+      var_covar_mats.resize(active);
+   }
+   if (fits.size() < active)
+   {
+      fits.resize(active);
+   }
+   for (size_t a = 0; a < active; ++a)
+   {
+      order[a] = a;
+      fits[a].status = irls_not_converged;
+   }
+
+   arma::mat& probs = workspace.batch_probs;
+   arma::mat& weights = workspace.batch_weights;
+   arma::mat& residuals = workspace.batch_residuals;
+   arma::mat& information = workspace.batch_information;
+   arma::mat& packed_var_covar = workspace.batch_packed_var_covar;
+   arma::mat& leverages = workspace.batch_leverages;
+   arma::mat& score = workspace.batch_score;
+   arma::mat& unpacked = workspace.batch_unpacked;
+   arma::vec& step = workspace.batch_step;
+   unpacked.set_size(x_design.n_cols, x_design.n_cols);
+   for (unsigned int i = 0; i < max_nr_iterations && active > 0; ++i)
+   {
+      countNewtonIterations(active);
+
+      // Fitted probabilities and weights of every active pair
+      probs = x_design * b.head_cols(active);
+      probs = 1 / (1 + arma::exp(-probs));
+      weights = probs % (1 - probs);
+
+      // Column a holds the packed X'WX of pair a
+      information = x_products.t() * weights;
+
+      if (firth)
+      {
+         packed_var_covar.zeros(x_products.n_cols, active);
+      }
+      for (size_t a = 0; a < active; ++a)
+      {
+         unpackProducts(information.colptr(a), unpacked);
+         finished[a] = !invertInformation(unpacked, i == 0 ? null_inverses[order[a]] : nullptr, workspace.batch_schur, var_covar_mats[a]);
+         if (finished[a])
+         {
+            fits[order[a]].status = irls_inv_fail;
+         }
+         else if (firth)
+         {
+            packQuadraticForm(var_covar_mats[a], packed_var_covar.colptr(a));
+         }
+      }
+
+      residuals = y.head_cols(active) - probs;
+      if (firth)
+      {
+         // Firth logistic regression
+         // See: DOI: 10.1002/sim.1047
+         // Leverages w_i * x_i' (X'WX)^-1 x_i for every pair at once
+         leverages = x_products * packed_var_covar;
+         probs = 0.5 - probs;
+         residuals += weights % leverages % probs;
+      }
+      score = x_design.t() * residuals;
+
+      for (size_t a = 0; a < active; ++a)
+      {
+         if (finished[a])
+         {
+            continue;
+         }
+
+         step = var_covar_mats[a] * score.col(a);
+         b.col(a) += step;
+         if (std::abs(step(1)) < convergence_limit)
+         {
+            finished[a] = true;
+
+            batchFit& fit = fits[order[a]];
+            fit.status = irls_converged;
+            fit.b = b.col(a);
+            fit.var_covar_mat = var_covar_mats[a];
+         }
+      }
+
+      // Drop finished pairs. Going backwards, the last active column has
+      // always already been checked. The inverse buffers are swapped so
+      // each keeps its memory
+      for (size_t a = active; a-- > 0; )
+      {
+         if (finished[a])
+         {
+            active--;
+            if (a != active)
+            {
+               b.col(a) = b.col(active);
+               y.col(a) = y.col(active);
+               order[a] = order[active];
+               finished[a] = finished[active];
+               var_covar_mats[a].swap(var_covar_mats[active]);
+            }
+         }
+      }
+   }
+}
+
+// Fits each of the pairs with batchedNewton. The alternative model is the
+// null model plus x, so starts from the null fit with b_x = 0
+static void fitBatch(const std::vector<BacterialVariant>& all_bacteria, const std::vector<size_t>& pairs, const bool firth, fitWorkspace& workspace)
+{
+   const size_t num_coefficients = workspace.x_design.n_cols;
+   workspace.batch_y.set_size(workspace.x_design.n_rows, pairs.size());
+   workspace.batch_start.zeros(num_coefficients, pairs.size());
+   workspace.batch_null_inverses.assign(pairs.size(), nullptr);
+   for (size_t k = 0; k < pairs.size(); ++k)
+   {
+      const BacterialVariant& bact = all_bacteria[pairs[k]];
+      bact.get_y(workspace.y_train);
+      workspace.batch_y.col(k) = workspace.y_train;
+
+      const arma::vec& null_coefficients = bact.null_coefficients();
+      if (null_coefficients.n_elem == num_coefficients - 1)
+      {
+         workspace.batch_start(0,k) = null_coefficients(0);
+         for (size_t j = 1; j < null_coefficients.n_elem; ++j)
+         {
+            workspace.batch_start(j + 1,k) = null_coefficients(j);
+         }
+
+         if (bact.null_inverse_information().n_rows == num_coefficients - 1)
+         {
+            workspace.batch_null_inverses[k] = &bact.null_inverse_information();
+         }
+      }
+      else
+      {
+         // The null fit failed, so start from the intercept alone
+         double mean_y = mean(workspace.y_train);
+         workspace.batch_start(0,k) = log(mean_y/(1 - mean_y));
+      }
+   }
+
+   batchedNewton(workspace.x_design, workspace.x_products, workspace.batch_y, workspace.batch_start, workspace.batch_null_inverses, firth, workspace);
+}
+
+// Equivalent of doLogit for the pairs of one human variant with each of the
+// bacterial variants listed in pairs[start, end), which must all share the
+// same covariates. Newton iterations replace BFGS, as in groupedLogit, and
+// pairs which do not converge or have a large SE are flagged as it does. A
+// failed inversion is flagged as in newtonRaphson. Pairs which fail go on to
+// Firth regression, which is also done for the batch together
+void batchedLogit(const HumanVariant& human, const std::vector<BacterialVariant>& all_bacteria, const std::vector<size_t>& pairs, const size_t start, const size_t end, std::vector<PairResult>& results)
+{
+   if (start == end)
+   {
+      return;
+   }
+
+   fitWorkspace& workspace = threadWorkspace();
+   designMatrix(human.genotypes(), all_bacteria[pairs[start]], workspace.x_design);
+   designProducts(workspace.x_design, workspace.x_products);
+
+   // Pairs flagged by the screen go straight to Firth regression
+   std::vector<size_t>& plain_pairs = workspace.plain_pairs;
+   std::vector<size_t>& firth_pairs = workspace.firth_pairs;
+   plain_pairs.clear();
+   firth_pairs.clear();
+   for (size_t k = start; k < end; ++k)
+   {
+      if (results[pairs[k]].firth)
+      {
+         firth_pairs.push_back(pairs[k]);
+      }
+      else
+      {
+         plain_pairs.push_back(pairs[k]);
+      }
+   }
+
+   const std::vector<batchFit>& fits = workspace.batch_fits;
+   if (!plain_pairs.empty())
+   {
+      fitBatch(all_bacteria, plain_pairs, 0, workspace);
+      for (size_t k = 0; k < plain_pairs.size(); ++k)
+      {
+         PairResult& p = results[plain_pairs[k]];
+         const batchFit& fit = fits[k];
+
+         if (fit.status == irls_inv_fail)
+         {
+            p.flags |= flag_inv_fail;
+            p.lrt_p = 0;
+            std::cerr << "Inversion at input line " << p.bact_line << "," << p.human_line << " failed" << std::endl;
+         }
+         // This stage takes the place of BFGS in doLogit. Where BFGS would
+         // run off towards infinity, Newton fails to converge or gives a
+         // large SE, and both go on to Firth regression flagged as a large
+         // SE, as in groupedLogit
+         else if (fit.status == irls_not_converged)
+         {
+            p.flags |= flag_large_se;
+            firth_pairs.push_back(plain_pairs[k]);
+         }
+         else
+         {
+            double se = pow(fit.var_covar_mat(1,1), 0.5);
+            if (se <= se_limit)
+            {
+               all_bacteria[plain_pairs[k]].get_y(workspace.y_train);
+               LogitLikelihood likelihood_fit(workspace.x_design, workspace.y_train);
+
+               p.beta = fit.b(1);
+               p.log_likelihood = likelihood_fit(fit.b);
+               p.se = se;
+               p.lrt_p = normalPval(std::abs(p.beta) / se);
+            }
+            else
+            {
+               p.flags |= flag_large_se;
+               firth_pairs.push_back(plain_pairs[k]);
+            }
+         }
+      }
+   }
+
+   if (!firth_pairs.empty())
+   {
+      fitBatch(all_bacteria, firth_pairs, 1, workspace);
+      for (size_t k = 0; k < firth_pairs.size(); ++k)
+      {
+         PairResult& p = results[firth_pairs[k]];
+         const batchFit& fit = fits[k];
+
+         if (fit.status == irls_inv_fail)
+         {
+            p.flags |= flag_inv_fail;
+            p.lrt_p = 0;
+            std::cerr << "Inversion at input line " << p.bact_line << "," << p.human_line << " failed" << std::endl;
+         }
+         else if (fit.status == irls_not_converged)
+         {
+            p.flags |= flag_firth_fail;
+         }
+         else
+         {
+            all_bacteria[firth_pairs[k]].get_y(workspace.y_train);
+            LogitLikelihood likelihood_fit(workspace.x_design, workspace.y_train);
+
+            p.log_likelihood = likelihood_fit(fit.b);
+            if (p.firth)
+            {
+               p.log_likelihood += 0.5*log(det(inv_covar(fit.var_covar_mat)));
+            }
+
+            p.beta = fit.b(1);
+            p.se = pow(fit.var_covar_mat(1,1), 0.5);
+            if (p.se > se_limit)
+            {
+               p.flags |= flag_large_se;
+            }
+            p.lrt_p = normalPval(std::abs(p.beta) / p.se);
+         }
+      }
+   }
+}
+
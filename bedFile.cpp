@@ -0,0 +1,210 @@
+/*
+ * File: bedFile.cpp
+ *
+ * Reads PLINK .bed/.bim/.fam human genotypes. The .bed is memory mapped
+ * and its 2-bit codes are split into bit planes with word operations
+ *
+ */
+
+#include "bedFile.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// Replaces the .bed extension of a path
+static std::string plinkFile(const std::string& bed_file, const std::string& extension)
+{
+   std::string prefix = bed_file;
+   if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".bed") == 0)
+   {
+      prefix.erase(prefix.size() - 4);
+   }
+   return prefix + extension;
+}
+
+// Gathers the even bits of a word into its low 32 bits
+static inline uint64_t evenBits(uint64_t word)
+{
+   word &= 0x5555555555555555ULL;
+   word = (word | (word >> 1)) & 0x3333333333333333ULL;
+   word = (word | (word >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+   word = (word | (word >> 4)) & 0x00ff00ff00ff00ffULL;
+   word = (word | (word >> 8)) & 0x0000ffff0000ffffULL;
+   word = (word | (word >> 16)) & 0x00000000ffffffffULL;
+   return word;
+}
+
+// Checks whether a file starts with the SNP-major .bed magic number
+bool isBedFile(const std::string& filename)
+{
+   std::ifstream in(filename.c_str(), std::ios::binary);
+   char magic[sizeof(bed_magic)];
+   if (!in.read(magic, sizeof(magic)))
+   {
+      return false;
+   }
+   return memcmp(magic, bed_magic, sizeof(magic)) == 0;
+}
+
+BedFile::BedFile(const std::string& bed_file)
+   :_bed(bed_file), _variant_bytes(0)
+{
+   // Sample IDs are the second column of the .fam
+   std::ifstream fam_in(plinkFile(bed_file, ".fam").c_str());
+   if (!fam_in)
+   {
+      throw std::runtime_error("Could not open .fam for " + bed_file);
+   }
+   std::string line;
+   while (std::getline(fam_in, line))
+   {
+      std::istringstream fields(line);
+      std::string family_id, sample_id;
+      if (fields >> family_id >> sample_id)
+      {
+         _sample_ids.push_back(sample_id);
+      }
+   }
+
+   // Chromosome and position are the first and fourth columns of the .bim
+   std::ifstream bim_in(plinkFile(bed_file, ".bim").c_str());
+   if (!bim_in)
+   {
+      throw std::runtime_error("Could not open .bim for " + bed_file);
+   }
+   while (std::getline(bim_in, line))
+   {
+      std::istringstream fields(line);
+      std::string chromosome, variant_id;
+      double genetic_distance;
+      long int position;
+      if (fields >> chromosome >> variant_id >> genetic_distance >> position)
+      {
+         _chromosomes.push_back(chromosome);
+         _positions.push_back(position);
+      }
+   }
+
+   _variant_bytes = (samples() + 3) / 4;
+   if (memcmp(_bed.data(), bed_magic, sizeof(bed_magic)) != 0)
+   {
+      throw std::runtime_error(bed_file + " is not a SNP-major PLINK .bed file");
+   }
+   else if (_bed.size() != sizeof(bed_magic) + variants() * _variant_bytes)
+   {
+      throw std::runtime_error(bed_file + " does not match the number of samples and variants in its .fam and .bim");
+   }
+}
+
+// Each byte holds four samples, lowest bits first, coded as
+//    00 homozygous A1, 01 missing, 10 heterozygous, 11 homozygous A2
+// Eight bytes give 32 samples, which become half a word of each plane
+void BedFile::planes(const size_t variant, bitPlane& het, bitPlane& hom, bitPlane& missing) const
+{
+   const size_t words = planeWords(samples());
+   het.assign(words, 0);
+   hom.assign(words, 0);
+   missing.assign(words, 0);
+
+   const unsigned char* record = reinterpret_cast<const unsigned char*>(_bed.data()) + sizeof(bed_magic) + variant * _variant_bytes;
+   for (size_t offset = 0; offset < _variant_bytes; offset += 8)
+   {
+      uint64_t codes = 0;
+      size_t chunk_bytes = std::min((size_t)8, _variant_bytes - offset);
+      memcpy(&codes, record + offset, chunk_bytes);
+
+      uint64_t low = evenBits(codes);
+      uint64_t high = evenBits(codes >> 1);
+
+      // Samples past the end are padded with 00, so mask them out of hom
+      size_t first_sample = offset * 4;
+      size_t chunk_samples = std::min((size_t)32, samples() - first_sample);
+      uint64_t valid = chunk_samples == 32 ? 0xffffffffULL : ((uint64_t)1 << chunk_samples) - 1;
+
+      size_t shift = first_sample & 63;
+      het[first_sample >> 6] |= ((high & ~low) & valid) << shift;
+      hom[first_sample >> 6] |= ((~high & ~low) & valid) << shift;
+      missing[first_sample >> 6] |= ((~high & low) & valid) << shift;
+   }
+}
+
+std::pair<long int, long int> BedFile::region(const std::string& region) const
+{
+   size_t colon = region.find(':');
+   size_t dash = region.find('-', colon == std::string::npos ? 0 : colon);
+   if (colon == std::string::npos || dash == std::string::npos)
+   {
+      throw std::runtime_error("region " + region + " should be given as chr:start-end");
+   }
+   std::string chromosome = region.substr(0, colon);
+   long int start, end;
+   size_t start_length, end_length;
+   try
+   {
+      start = std::stol(region.substr(colon + 1, dash - colon - 1), &start_length);
+      end = std::stol(region.substr(dash + 1), &end_length);
+   }
+   catch (const std::logic_error& e)
+   {
+      throw std::runtime_error("region " + region + " should be given as chr:start-end, with whole number positions");
+   }
+   if (start_length != dash - colon - 1 || end_length != region.size() - dash - 1 || start > end)
+   {
+      throw std::runtime_error("region " + region + " should be given as chr:start-end, with whole number positions");
+   }
+
+   long int first = 0, last = 0;
+   for (size_t i = 0; i < variants(); ++i)
+   {
+      if (_chromosomes[i] == chromosome && _positions[i] >= start && _positions[i] <= end)
+      {
+         if (first == 0)
+         {
+            first = i + 1;
+         }
+         else if (last != (long int)i)
+         {
+            throw std::runtime_error("variants in region " + region + " are not contiguous in the .bim");
+         }
+         last = i + 1;
+      }
+   }
+
+   if (first == 0)
+   {
+      throw std::runtime_error("no variants in region " + region);
+   }
+   return std::make_pair(first, last);
+}
+
+// Checks the .fam samples are in the same order as a list of sample IDs,
+// one per line, giving the order of the other input files
+void checkSampleOrder(const std::vector<std::string>& fam_ids, const std::string& sample_file)
+{
+   std::ifstream samples_in(sample_file.c_str());
+   if (!samples_in)
+   {
+      throw std::runtime_error("Could not open sample list " + sample_file);
+   }
+
+   std::string sample_id;
+   size_t i = 0;
+   while (samples_in >> sample_id)
+   {
+      if (i >= fam_ids.size())
+      {
+         throw std::runtime_error("sample list " + sample_file + " has more samples than the .fam");
+      }
+      else if (fam_ids[i] != sample_id)
+      {
+         throw std::runtime_error("sample " + std::to_string(i + 1) + " is " + fam_ids[i] + " in the .fam but " + sample_id + " in " + sample_file);
+      }
+      i++;
+   }
+
+   if (i != fam_ids.size())
+   {
+      throw std::runtime_error("sample list " + sample_file + " has fewer samples than the .fam");
+   }
+}
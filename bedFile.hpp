@@ -0,0 +1,52 @@
+/*
+ * bedFile.hpp
+ * Header file for BedFile class, which reads PLINK binary genotypes
+ *
+ */
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <stdexcept>
+
+// Packed planes and mapped files
+#include "genotypeFile.hpp"
+
+const unsigned char bed_magic[3] = {0x6c, 0x1b, 0x01}; // SNP-major
+
+// A memory mapped .bed file, with its .bim and .fam alongside. Genotypes
+// are the number of copies of the first (A1) allele in the .bim
+class BedFile
+{
+   public:
+      // Initialisation. Takes the path to the .bed
+      BedFile(const std::string& bed_file); // this is defined in bedFile.cpp
+
+      // nonmodifying operations
+      size_t samples() const { return _sample_ids.size(); }
+      size_t variants() const { return _chromosomes.size(); }
+      const std::vector<std::string>& sample_ids() const { return _sample_ids; }
+
+      // Converts the 2-bit codes of a variant (0-indexed) to bit planes
+      void planes(const size_t variant, bitPlane& het, bitPlane& hom, bitPlane& missing) const; // this is defined in bedFile.cpp
+
+      // First and last variant (1-indexed, inclusive) of a region given as
+      // chr:start-end, which must be contiguous in the .bim
+      std::pair<long int, long int> region(const std::string& region) const; // this is defined in bedFile.cpp
+
+   private:
+      MappedFile _bed;
+      size_t _variant_bytes;
+
+      std::vector<std::string> _sample_ids;
+      std::vector<std::string> _chromosomes;
+      std::vector<long int> _positions;
+};
+
+// bedFile.cpp
+bool isBedFile(const std::string& filename);
+void checkSampleOrder(const std::vector<std::string>& fam_ids, const std::string& sample_file);
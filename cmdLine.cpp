@@ -19,14 +19,22 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    //Required options
    po::options_description required("Required options");
    required.add_options()
-    ("bacteria", po::value<std::string>()->required(), "human snps")
-    ("human", po::value<std::string>()->required(), "bacterial snps")
+    ("bacteria", po::value<std::string>()->required(), "bacterial snps (csv or packed binary)")
+    ("human", po::value<std::string>()->required(), "human snps (csv, packed binary or PLINK .bed)")
     ("output", po::value<std::string>()->required(), "output name");
 
+   //Options only used with PLINK .bed human input
+   po::options_description plink("PLINK input options");
+   plink.add_options()
+    ("region", po::value<std::string>(), "only test human variants in this region of the .bim (chr:start-end)")
+    ("samples", po::value<std::string>(), "sample IDs in the order of the other input files, to check against the .fam");
+
    //may want to add covariates in later (e.g. for pop struct)
    po::options_description covar("Covariate options");
    covar.add_options()
-    ("struct", po::value<std::string>(), "mds values from kmds");
+    ("struct", po::value<std::string>(), "mds values from kmds")
+    ("no_orthogonalise", "fit with the --struct values as given, rather than an orthonormal basis for them")
+    ("null_cache", po::value<std::string>(), "file to store null model fits in, for reuse by later jobs on the same input");
     //("covar_file", po::value<std::string>(), "file containing covariates")
     //("covar_list", po::value<std::string>(), "list of columns covariates to use. Format is 1,2q,3 (use q for quantitative)");
 
@@ -34,7 +42,10 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    po::options_description performance("Performance options");
    performance.add_options()
     ("chunk_start", po::value<long int>()->default_value(0), ("start coordinate in human snps (1-start; inclusive)"))
-    ("chunk_end", po::value<long int>()->default_value(0), ("end coordinate in human snps (1-start; inclusive)"));
+    ("chunk_end", po::value<long int>()->default_value(0), ("end coordinate in human snps (1-start; inclusive)"))
+    ("threads", po::value<int>()->default_value(1), ("number of threads to test pairs with"))
+    ("human_block", po::value<int>()->default_value(human_block_default), ("number of human variants screened together"))
+    ("kernel", po::value<std::string>()->default_value(kernel_default), ("genotype counting kernels to use. One of auto, scalar, sse42, avx2 or avx512"));
 
    //Optional filtering parameters
    //NB pval cutoffs are strings for display, and are converted to floats later
@@ -42,7 +53,8 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
    filtering.add_options()
     ("maf", po::value<std::string>()->default_value(maf_default), "minimum variant frequency")
     ("missing", po::value<std::string>()->default_value(missing_default), "maximum missing rate")
-    ("chisq", po::value<std::string>()->default_value(chisq_default), "p-value threshold for initial chi squared test. Set to 1 to show all")
+    ("chisq", po::value<std::string>()->default_value(chisq_default), "p-value threshold for initial screening test. Set to 1 to show all")
+    ("screen", po::value<std::string>()->default_value(screen_default), "initial screening test. chisq (covariate-blind) or score (adjusted for --struct)")
     ("pval", po::value<std::string>()->default_value(pval_default), "p-value threshold for final logistic test. Set to 1 to show all");
 
    po::options_description other("Other options");
@@ -51,7 +63,7 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
     ("help,h", "full help message");
 
    po::options_description all;
-   all.add(required).add(covar).add(performance).add(filtering).add(other);
+   all.add(required).add(plink).add(covar).add(performance).add(filtering).add(other);
 
    try
    {
@@ -81,6 +93,10 @@ int parseCommandLine (int argc, char *argv[], po::variables_map& vm)
          {
             failed = 1;
          }
+         else if (vm.count("samples") && !fileStat(vm["samples"].as<std::string>()))
+         {
+            failed = 1;
+         }
       }
 
    }
@@ -7,6 +7,9 @@
 
 #include "epistasis.hpp"
 
+#include <atomic>
+#include <new>
+
 // Parse command line parameters into usable program parameters
 cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, double num_samples)
 {
@@ -32,6 +35,21 @@ cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, double n
       verified.struct_file = vm["struct"].as<std::string>();
    }
 
+   if(vm.count("null_cache"))
+   {
+      verified.null_cache = vm["null_cache"].as<std::string>();
+   }
+
+   if(vm.count("region"))
+   {
+      verified.region = vm["region"].as<std::string>();
+   }
+
+   if(vm.count("samples"))
+   {
+      verified.sample_file = vm["samples"].as<std::string>();
+   }
+
    if(vm.count("chisq"))
    {
       verified.chi_cutoff = stod(vm["chisq"].as<std::string>());
@@ -60,6 +78,74 @@ cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, double n
       verified.chunk_end = 0;
    }
 
+   // 0 means the chunk has no start or end
+   if (verified.chunk_start < 0 || verified.chunk_end < 0)
+   {
+      throw std::runtime_error("chunk start and end must be positive line numbers");
+   }
+
+   if (vm.count("threads"))
+   {
+      int threads_in = vm["threads"].as<int>();
+      if (threads_in >= 1)
+      {
+         verified.num_threads = threads_in;
+      }
+      else
+      {
+         throw std::runtime_error("threads must be at least 1");
+      }
+   }
+   else
+   {
+      verified.num_threads = 1;
+   }
+
+   if (vm.count("human_block"))
+   {
+      int block_in = vm["human_block"].as<int>();
+      if (block_in >= 1)
+      {
+         verified.human_block = block_in;
+      }
+      else
+      {
+         throw std::runtime_error("human_block must be at least 1");
+      }
+   }
+   else
+   {
+      verified.human_block = human_block_default;
+   }
+
+   if (vm.count("kernel"))
+   {
+      verified.kernel = vm["kernel"].as<std::string>();
+      if (verified.kernel != "auto" && verified.kernel != "scalar" && verified.kernel != "sse42" && verified.kernel != "avx2" && verified.kernel != "avx512")
+      {
+         throw std::runtime_error("unknown kernel " + verified.kernel);
+      }
+   }
+   else
+   {
+      verified.kernel = kernel_default;
+   }
+
+   if (vm.count("screen"))
+   {
+      verified.screen = vm["screen"].as<std::string>();
+      if (verified.screen != "chisq" && verified.screen != "score")
+      {
+         throw std::runtime_error("unknown screen " + verified.screen);
+      }
+   }
+   else
+   {
+      verified.screen = screen_default;
+   }
+
+   verified.orthogonalise = !vm.count("no_orthogonalise");
+
    // Error check filtering options
    double maf_in = stod(vm["maf"].as<std::string>());
    if (maf_in >= 0 && maf_in <= 0.5)
@@ -108,6 +194,30 @@ column_vector arma_to_dlib(const arma::vec& arma_vec)
    return converted;
 }
 
+// Work done by fits with covariates, counted across all threads
+static std::atomic<uint64_t> pinv_fallbacks(0);
+static std::atomic<uint64_t> newton_iterations(0);
+static std::atomic<uint64_t> likelihood_evaluations(0);
+
+void countNewtonIterations(const uint64_t iterations)
+{
+   newton_iterations.fetch_add(iterations, std::memory_order_relaxed);
+}
+
+void countLikelihoodEvaluation()
+{
+   likelihood_evaluations.fetch_add(1, std::memory_order_relaxed);
+}
+
+fitCounts fitCounters()
+{
+   fitCounts counts;
+   counts.pinv_fallbacks = pinv_fallbacks;
+   counts.newton_iterations = newton_iterations;
+   counts.likelihood_evaluations = likelihood_evaluations;
+   return counts;
+}
+
 // Inverts a symmetric positive matrix, checking for errors
 // Not passed by ref, creates a copy. Right thing to do?
 arma::mat inv_covar(arma::mat A)
@@ -117,6 +227,8 @@ arma::mat inv_covar(arma::mat A)
    arma::mat B;
    if (!inv_sympd(B, A))
    {
+      pinv_fallbacks.fetch_add(1, std::memory_order_relaxed);
+
       // If the Cholesky decomposition fails, try pseudo-inverse
       // This uses SVD:
       // A = U*S*V.t() => A^-1 = V*S^-1*U.t()
@@ -130,6 +242,50 @@ arma::mat inv_covar(arma::mat A)
    return B;
 }
 
+// Replaces the covariates with an orthonormal basis for the space they span
+// with the intercept, leaving out the intercept itself, scaled so each column
+// has unit variance. Any model fitted with them is the same, so the
+// coefficient and SE of the human variant are unchanged, but the information
+// matrices are far better conditioned. Columns which are combinations of the
+// others are dropped. Uses Gram-Schmidt QR, with a second pass to keep the
+// basis orthogonal to working precision. Returns false, leaving covariates
+// untouched, if none are left
+bool orthogonaliseCovariates(arma::mat& covariates)
+{
+   const size_t num_samples = covariates.n_rows;
+   arma::mat basis(num_samples, covariates.n_cols + 1);
+   basis.col(0).fill(1 / sqrt((double)num_samples));
+
+   size_t rank = 1;
+   for (size_t j = 0; j < covariates.n_cols; ++j)
+   {
+      arma::vec column = covariates.col(j);
+      double norm = arma::norm(column);
+      for (int pass = 0; pass < 2; ++pass)
+      {
+         column -= basis.head_cols(rank) * (basis.head_cols(rank).t() * column);
+      }
+
+      double remaining = arma::norm(column);
+      if (remaining > 1e-8 * norm)
+      {
+         basis.col(rank++) = column / remaining;
+      }
+      else
+      {
+         std::cerr << "WARNING: Covariate column " << j + 1 << " is a combination of the intercept and earlier columns, and is not used" << std::endl;
+      }
+   }
+
+   if (rank == 1)
+   {
+      return false;
+   }
+
+   covariates = basis.cols(1, rank - 1) * sqrt((double)num_samples);
+   return true;
+}
+
 // Check for file existence
 int fileStat(const std::string& filename)
 {
@@ -146,3 +302,49 @@ int fileStat(const std::string& filename)
    return success;
 }
 
+#ifdef SEER_DEBUG
+// Count the heap allocations of each thread, through both operator new and
+// armadillo, to check the fitting loop does not allocate
+static thread_local uint64_t thread_allocations = 0;
+
+void* countedMalloc(size_t size)
+{
+   thread_allocations++;
+   return malloc(size == 0 ? 1 : size);
+}
+
+void countedFree(void* ptr)
+{
+   free(ptr);
+}
+
+void* operator new(size_t size)
+{
+   void* ptr = countedMalloc(size);
+   if (ptr == nullptr)
+   {
+      throw std::bad_alloc();
+   }
+   return ptr;
+}
+
+void* operator new[](size_t size)
+{
+   return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+   countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+   countedFree(ptr);
+}
+
+uint64_t threadHeapAllocations()
+{
+   return thread_allocations;
+}
+#endif
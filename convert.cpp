@@ -0,0 +1,110 @@
+/*
+ * File: convert.cpp
+ *
+ * epistasis-convert: converts a csv genotype file into the packed binary
+ * format, which epistasis can memory map directly
+ *
+ */
+
+#include "epistasis.hpp"
+
+namespace po = boost::program_options; // Save some typing
+
+int main (int argc, char *argv[])
+{
+   std::cerr << "epistasis-convert: packs csv genotypes into a binary file for epistasis\n";
+
+   po::options_description options("Options");
+   options.add_options()
+    ("input", po::value<std::string>()->required(), "csv genotypes (may be gzipped)")
+    ("output", po::value<std::string>()->required(), "output binary file")
+    ("type", po::value<std::string>()->required(), "type of genotypes: human (0/0, 0/1, 1/1) or bacteria (0, 1)")
+    ("help,h", "full help message");
+
+   po::variables_map vm;
+   try
+   {
+      po::store(po::command_line_parser(argc, argv).options(options).run(), vm);
+      if (argc == 1 || vm.count("help"))
+      {
+         std::cerr << options << "\n";
+         return 0;
+      }
+      po::notify(vm);
+   }
+   catch (po::error& e)
+   {
+      std::cerr << "Error in command line input: " << e.what() << "\n\n";
+      std::cerr << options << "\n";
+      return 1;
+   }
+
+   std::string input_file = vm["input"].as<std::string>();
+   std::string output_file = vm["output"].as<std::string>();
+
+   genotypeFileType type;
+   if (vm["type"].as<std::string>() == "human")
+   {
+      type = human_genotypes;
+   }
+   else if (vm["type"].as<std::string>() == "bacteria")
+   {
+      type = bacterial_genotypes;
+   }
+   else
+   {
+      std::cerr << "--type must be human or bacteria\n";
+      return 1;
+   }
+
+   std::ifstream input_check(input_file.c_str());
+   if (!input_check)
+   {
+      std::cerr << "Can't open input file: " << input_file << "\n";
+      return 1;
+   }
+
+   // First line gives the number of samples
+   std::string line_buffer;
+   size_t num_samples = 0;
+   {
+      igzstream first_in;
+      first_in.open(input_file.c_str());
+      if (readCsvLine(first_in, line_buffer))
+      {
+         num_samples = countCsvFields(line_buffer);
+      }
+   }
+   if (num_samples == 0)
+   {
+      std::cerr << "No samples found in " << input_file << "\n";
+      return 1;
+   }
+
+   igzstream csv_in;
+   csv_in.open(input_file.c_str());
+
+   GenotypeFileWriter binary_out(output_file, type, num_samples);
+   std::vector<uint8_t> genotype_buffer(num_samples);
+
+   long int line_nr = 1;
+   while (readCsvLine(csv_in, line_buffer))
+   {
+      if (type == human_genotypes)
+      {
+         decodeHumanLine(line_buffer, line_nr, num_samples, genotype_buffer);
+      }
+      else
+      {
+         decodeBacterialLine(line_buffer, line_nr, num_samples, genotype_buffer);
+      }
+      binary_out.add_variant(genotype_buffer);
+      line_nr++;
+   }
+   binary_out.close();
+
+   std::cerr << "Wrote " << binary_out.variants() << " variants of " << num_samples << " samples to " << output_file << "\n";
+   std::cerr << "Done.\n";
+
+   return 0;
+}
@@ -14,14 +14,34 @@ const std::string maf_default = "0.05";
 const std::string missing_default = "0.05";
 const std::string chisq_default = "1";
 const std::string pval_default = "1";
+const std::string kernel_default = "auto";
+const std::string screen_default = "chisq";
 const double convergence_limit = 10e-8;
 const unsigned int max_nr_iterations = 1000;
 const double se_limit = 3;
 
-// Starting value for beta vectors (except intercept)
+// Starting value for beta vectors (except intercept) in BFGS null model
+// fits. Alternative model fits start from the null fit instead
 // Should be >0. This value is based on RMS in example study
 const double bfgs_start_beta = 1;
 
+// Number of bacterial pairs handed to a thread at a time
+const size_t pair_block_size = 64;
+
+// Number of bacterial variants handed from the reader to the null model fits
+// at a time
+const size_t bacterial_batch_size = 256;
+
+// Number of contingency tables whose Fisher p-value, and separately whose
+// covariate-free fit, are kept
+const size_t table_cache_size = 1 << 20;
+
+// Number of pairs with covariates fitted together
+const size_t logit_batch_size = 64;
+
+// Number of human variants screened together
+const int human_block_default = 32;
+
 int main (int argc, char *argv[])
 {
    // Read line of file to get size
@@ -57,107 +77,114 @@ int main (int argc, char *argv[])
    }
 
    // Open human file to get number of samples
-   std::vector<std::string> human_variant;
-   if (vm.count("human"))
+   size_t num_samples = 0;
+   std::shared_ptr<const BedFile> human_bed;
+   if (vm.count("human") && isGenotypeFile(vm["human"].as<std::string>()))
+   {
+      GenotypeFile human_in(vm["human"].as<std::string>());
+      num_samples = human_in.samples();
+   }
+   else if (vm.count("human") && isBedFile(vm["human"].as<std::string>()))
    {
+      // Opened once, and kept to read the variants from
+      human_bed = std::make_shared<const BedFile>(vm["human"].as<std::string>());
+      num_samples = human_bed->samples();
+   }
+   else if (vm.count("human"))
+   {
+      std::string line_buffer;
       igzstream human_in;
       human_in.open(vm["human"].as<std::string>().c_str());
-      human_variant = readCsvLine(human_in);
+      readCsvLine(human_in, line_buffer);
+      num_samples = countCsvFields(line_buffer);
    }
    else
    {
       throw std::runtime_error("--human option is compulsory");
    }
 
-   size_t num_samples = human_variant.size();
-
    // Error check command line options
    cmdOptions parameters = verifyCommandLine(vm, num_samples);
 
-   // Get mds values
-   arma::mat mds;
-   int use_mds = 0;
+   // Pick the genotype counting kernels for this CPU
+   if (!crossCheckKernels())
+   {
+      throw std::runtime_error("genotype counting kernels do not agree");
+   }
+   std::cerr << "Using " << selectKernels(parameters.kernel).name << " genotype counting kernels" << std::endl;
+
+   // Get mds values. These are held once and shared by every pair
+   std::shared_ptr<const arma::mat> mds;
    if (fileStat(parameters.struct_file))
    {
-      mds.load(parameters.struct_file);
+      arma::mat mds_in;
+      mds_in.load(parameters.struct_file);
 
-      if (mds.n_rows != num_samples)
+      if (mds_in.n_rows != num_samples)
       {
          throw std::runtime_error("Number of rows in MDS matrix does not match number of samples");
       }
+      else if (parameters.orthogonalise && !orthogonaliseCovariates(mds_in))
+      {
+         std::cerr << "WARNING: Every column of the struct file is constant or a combination of the others. Running without covariates\n";
+      }
       else
       {
-         use_mds = 1;
+         mds = std::make_shared<const arma::mat>(std::move(mds_in));
          std::cerr << "WARNING: Struct file loaded. IT IS UP TO YOU to make sure the order of samples is the same as in each matrix\n";
       }
    }
 
-   // Open the human variant ifstream, and read through until the required
-   // block is reached
-   igzstream human_file;
-   human_file.open(parameters.human_file.c_str());
-
-   long int human_line_nr = 1;
-   if (parameters.chunk_start > 1 && parameters.chunk_end > 1)
+   // For PLINK input, check sample order and turn a region into a chunk
+   if (human_bed)
    {
-      if (parameters.chunk_start >= parameters.chunk_end)
+      if (!parameters.sample_file.empty())
       {
-         throw std::runtime_error("chunk start greater than or equal to chunk end");
+         checkSampleOrder(human_bed->sample_ids(), parameters.sample_file);
       }
       else
       {
-         std::cerr << "Reading to chunk position: line " << parameters.chunk_start << std::endl;
-         std::string line;
-         for (int i = 0; i < parameters.chunk_start - 1; i++)
-         {
-            std::getline(human_file, line);
-            human_line_nr++;
-         }
+         std::cerr << "WARNING: No --samples given. IT IS UP TO YOU to make sure the order of samples in the .fam is the same as in the other files\n";
       }
+
+      if (!parameters.region.empty())
+      {
+         std::pair<long int, long int> region = human_bed->region(parameters.region);
+         parameters.chunk_start = region.first;
+         parameters.chunk_end = region.second;
+         std::cerr << "Region " << parameters.region << " is .bim lines " << region.first << "-" << region.second << std::endl;
+      }
+   }
+   else if (!parameters.region.empty() || !parameters.sample_file.empty())
+   {
+      throw std::runtime_error("--region and --samples can only be used with PLINK .bed human input");
+   }
+
+   // Start reading the human variants in the background, reading through
+   // until the required block is reached. Enough are kept ready for the
+   // next block while one is being tested
+   if (parameters.chunk_start > 0 && parameters.chunk_end > 0 && parameters.chunk_start > parameters.chunk_end)
+   {
+      throw std::runtime_error("chunk start greater than chunk end");
    }
+   HumanReader human_reader(parameters.human_file, num_samples, parameters.chunk_start, parameters.chunk_end, 2 * parameters.human_block, human_bed);
+
+   // Threads are used to fit the null models as well as to test pairs
+   ThreadPool pool(parameters.num_threads);
 
    // Read in all the bacterial variants (3Mb compressed - shouldn't be too bad
    // in this form I hope)
    std::cerr << "Reading in all bacterial variants" << std::endl;
-   igzstream bacterial_file;
-   bacterial_file.open(parameters.bact_file.c_str());
-
-   std::vector<Pair> all_pairs;
-   long int bact_line_nr = 1;
-   while (bacterial_file)
+   std::vector<BacterialVariant> all_bacteria;
+   std::vector<patternLine> bact_lines;
+   long int bact_line_nr = readBacterialVariants(parameters, num_samples, mds, pool, all_bacteria, bact_lines);
+
+   // The score screen needs the residuals and weights of every null model,
+   // which are the same for every human variant
+   std::shared_ptr<const scoreTerms> score_terms;
+   if (parameters.screen == "score")
    {
-      std::vector<std::string> bacterial_variant = readCsvLine(bacterial_file);
-      if (bacterial_file)
-      {
-         Pair bact_in(num_samples);
-         bact_in.add_y(bacterial_variant, bact_line_nr);
-
-         // Check MAF and missingness of this variant
-         std::tuple<double,double> mafs = bact_in.maf();
-         std::tuple<double,double> missings = bact_in.missing();
-         if (std::get<1>(mafs) > parameters.min_af && std::get<1>(mafs) < parameters.max_af && std::get<1>(missings) < parameters.missing)
-         {
-            if (use_mds)
-            {
-               bact_in.add_covar(mds);
-            }
-
-            // If set here will calculate logistic regression for all bacterial
-            // variants if covar provided.
-            // Alternative would be to do for only pairs passing chi-sq. Less
-            // efficient if many pairs passing.
-            set_null_ll(bact_in);
-
-            all_pairs.push_back(bact_in);
-         }
-
-         bact_line_nr++;
-      }
-      else
-      {
-         bact_line_nr--;
-         break;
-      }
+      score_terms = nullScoreTerms(all_bacteria, pool);
    }
 
    // Write a header
@@ -175,84 +202,270 @@ int main (int argc, char *argv[])
       throw std::runtime_error("Could not write to output file " + parameters.output_file + ".gz");
    }
 
-   long int read_pairs = 0;
-   long int tested_pairs = 0;
-   long int significant_pairs = 0;
-   while (human_file)
+   // Counted as results are written, so include every duplicate
+   pairCounts counts = {0, 0, 0};
+   long int human_lines_tested = 0;
+   long int human_patterns_tested = 0;
+
+   // Many pairs have exactly the same table, so results which only depend
+   // on the table are shared
+   TableCache<double> fisher_cache(table_cache_size);
+   TableCache<groupedFit> fit_cache(table_cache_size);
+
+   // Results for one human variant against every bacterial variant. Reused
+   // for each human variant
+   std::vector<PairResult> results(all_bacteria.size());
+   std::vector<char> needs_fit(all_bacteria.size());
+   std::vector<size_t> pending;
+
+#ifdef SEER_DEBUG
+   // Workspaces grow to size during the first block, so allocations counted
+   // after that are made per pair. Each pool thread counts its own, which
+   // leaves out the human reader and bacterial parser threads
+   std::vector<uint64_t> thread_allocations(pool.size());
+   uint64_t fit_allocations = 0;
+   bool first_block = true;
+#endif
+
+   bool more_human = true;
+   while (more_human)
    {
-      std::vector<std::string> human_variant;
-      human_variant.reserve(num_samples);
-      human_variant = readCsvLine(human_file);
-
-      if (human_file)
+      // Read a block of human variants which pass the maf filter. Lines
+      // failing it have no pairs to test. These have been decoded in the
+      // background, once each, to be shared between all pairs
+      std::vector<std::shared_ptr<const HumanVariant>> human_block;
+      while (human_block.size() < parameters.human_block)
       {
-         // Test each human variant against every bacterial variant
-         for (auto it = all_pairs.begin(); it < all_pairs.end(); it++)
+         std::shared_ptr<const HumanVariant> human;
+         if (!human_reader.next(human))
          {
-            it->add_x(human_variant, human_line_nr);
-
-            // maf filter
-            std::tuple<double,double> mafs = it->maf();
-            std::tuple<double,double> missings = it->missing();
-            if (std::get<0>(mafs) > parameters.min_af && std::get<0>(mafs) < parameters.max_af && std::get<0>(missings) < parameters.missing)
-            {
-               it->chisq_p(chiTest(*it));
-               read_pairs++;
+            more_human = false;
+            break;
+         }
 
-               if (it->chisq_p() < parameters.chi_cutoff)
-               {
-                  doLogit(*it);
+         if (human->maf() > parameters.min_af && human->maf() < parameters.max_af && human->missing() < parameters.missing)
+         {
+            human_block.push_back(human);
+         }
+      }
 
-                  // Likelihood ratio test
-                  it->p_val(likelihoodRatioTest(*it));
+      if (human_block.empty())
+      {
+         continue;
+      }
 
-                  tested_pairs++;
-                  if (it->p_val() < parameters.log_cutoff)
+      // Identical human variants in the block are only tested once
+      std::vector<std::shared_ptr<const HumanVariant>> human_patterns;
+      std::vector<size_t> human_pattern_of = dedupHumanBlock(human_block, human_patterns);
+      std::vector<size_t> pattern_uses(human_patterns.size(), 0);
+      for (auto it = human_pattern_of.begin(); it != human_pattern_of.end(); ++it)
+      {
+         pattern_uses[*it]++;
+      }
+      human_lines_tested += human_block.size();
+      human_patterns_tested += human_patterns.size();
+
+      // Screen the whole block with chi^2 tests first
+      std::vector<tableTest> screen;
+      screenBlock(human_patterns, all_bacteria, score_terms, screen, fisher_cache, pool);
+
+      // Then test each human pattern against every bacterial pattern. Each
+      // result is only written by one thread. Results of human patterns
+      // which appear again later in the block are kept until then
+      std::vector<std::vector<PairResult>> kept_results(human_patterns.size());
+      for (size_t j = 0; j < human_block.size(); ++j)
+      {
+         size_t pattern = human_pattern_of[j];
+         const std::vector<PairResult>* pattern_results = &kept_results[pattern];
+         if (kept_results[pattern].empty())
+         {
+            pool.parallel_for(all_bacteria.size(), pair_block_size,
+               [&](size_t start, size_t end, unsigned int thread_id)
+               {
+#ifdef SEER_DEBUG
+                  uint64_t allocations_before = threadHeapAllocations();
+#endif
+                  for (size_t i = start; i < end; ++i)
                   {
-                     significant_pairs++;
+                     needs_fit[i] = testPair(*human_patterns[pattern], all_bacteria[i], screen[i * human_patterns.size() + pattern], parameters, fit_cache, results[i]);
                   }
+#ifdef SEER_DEBUG
+                  thread_allocations[thread_id] += threadHeapAllocations() - allocations_before;
+#endif
+               });
+
+            // Pairs with covariates only differ in y, so are fitted in
+            // batches. All bacterial variants share the same covariates
+            pending.clear();
+            for (size_t i = 0; i < all_bacteria.size(); ++i)
+            {
+               if (needs_fit[i])
+               {
+                  pending.push_back(i);
                }
+            }
+            pool.parallel_for(pending.size(), logit_batch_size,
+               [&](size_t start, size_t end, unsigned int thread_id)
+               {
+#ifdef SEER_DEBUG
+                  uint64_t allocations_before = threadHeapAllocations();
+#endif
+                  batchedLogit(*human_patterns[pattern], all_bacteria, pending, start, end, results);
+                  for (size_t k = start; k < end; ++k)
+                  {
+                     results[pending[k]].lrt_p = likelihoodRatioTest(results[pending[k]]);
+                  }
+#ifdef SEER_DEBUG
+                  thread_allocations[thread_id] += threadHeapAllocations() - allocations_before;
+#endif
+               });
 
-               out_stream << *it << std::endl;
+            pattern_results = &results;
+            if (pattern_uses[pattern] > 1)
+            {
+               kept_results[pattern] = results;
             }
          }
 
-         if (parameters.chunk_end > 1 && human_line_nr >= parameters.chunk_end)
+         // Write results in input order, one line for every bacterial line
+         for (auto it = bact_lines.begin(); it < bact_lines.end(); it++)
          {
-            human_line_nr--;
-            break;
-         }
-         else
-         {
-            human_line_nr++;
+            PairResult result = (*pattern_results)[it->pattern];
+            result.human_line = human_block[j]->line();
+            result.bact_line = it->line;
+            out_stream << result << std::endl;
+
+            countResult(result, parameters, counts);
          }
       }
-      else
+#ifdef SEER_DEBUG
+      for (auto it = thread_allocations.begin(); it != thread_allocations.end(); ++it)
       {
-         break;
+         fit_allocations += first_block ? 0 : *it;
+         *it = 0;
       }
+      first_block = false;
+#endif
    }
 
+   long int human_line_nr = human_reader.line_nr();
+   std::cerr << "Human reader: tests waited for input " << human_reader.starved() << " times, reader waited for tests " << human_reader.blocked() << " times\n";
+
    std::cerr << "Processed " << human_line_nr * bact_line_nr << " total pairs. Of these:\n";
-   std::cerr << "\tPassed maf filter:\t\t" << read_pairs << std::endl;
-   std::cerr << "\tPassed chi^2 filter:\t\t" << tested_pairs << std::endl;
-   std::cerr << "\tPassed p-val (logistic) filter:\t" << significant_pairs << std::endl;
+   std::cerr << "\tPassed maf filter:\t\t" << counts.read_pairs << std::endl;
+   std::cerr << "\tPassed chi^2 filter:\t\t" << counts.tested_pairs << std::endl;
+   std::cerr << "\tPassed p-val (logistic) filter:\t" << counts.significant_pairs << std::endl;
+   std::cerr << "Human variants: " << human_lines_tested << " passing filters, " << human_patterns_tested << " unique patterns within blocks ("
+             << (human_patterns_tested == 0 ? 1 : (double)human_lines_tested / human_patterns_tested) << "x compression)" << std::endl;
+   std::cerr << "Pairs tested once per pattern pair: " << human_patterns_tested * all_bacteria.size() << " of " << counts.read_pairs << std::endl;
+   std::cerr << "Table cache hits/misses:\n";
+   std::cerr << "\tFisher p-values:\t\t" << fisher_cache.hits() << "/" << fisher_cache.misses() << std::endl;
+   std::cerr << "\tCovariate-free fits:\t\t" << fit_cache.hits() << "/" << fit_cache.misses() << std::endl;
+   if (mds)
+   {
+      // Compare runs with and without --no_orthogonalise to see the effect
+      // of the covariate basis
+      fitCounts fit_counts = fitCounters();
+      std::cerr << "Fits with covariates (" << (parameters.orthogonalise ? "orthogonalised" : "raw") << " covariates):\n";
+      std::cerr << "\tNewton iterations:\t\t" << fit_counts.newton_iterations << std::endl;
+      std::cerr << "\tLikelihood evaluations:\t\t" << fit_counts.likelihood_evaluations << std::endl;
+      std::cerr << "\tInversions falling back to pinv:\t" << fit_counts.pinv_fallbacks << std::endl;
+   }
+#ifdef SEER_DEBUG
+   std::cerr << "Heap allocations while testing pairs, after the first block: " << fit_allocations << std::endl;
+#endif
    std::cerr << "Done.\n";
 }
 
-std::vector<std::string> readCsvLine(std::istream& is)
+// Applies the screen to a single pair, which must have passed the maf
+// filters, writing the outcome to result. Pairs passing it without
+// covariates are fitted here. Returns true if the pair passed the screen but
+// still needs fitting with covariates, which is done by batchedLogit
+bool testPair(const HumanVariant& human, const BacterialVariant& bact, const tableTest& screen, const cmdOptions& parameters, TableCache<groupedFit>& fit_cache, PairResult& result)
 {
-   std::vector<std::string> variant;
-   std::string line;
-   std::getline(is, line);
+   result.human_line = human.line();
+   result.bact_line = bact.line();
+   result.maf_x = human.maf();
+   result.maf_y = bact.maf();
+   result.null_ll = bact.null_ll();
+   result.chisq_p = screen.p_value;
+   result.lrt_p = 1;
+   result.log_likelihood = 0;
+   result.beta = 0;
+   result.se = 0;
+   result.flags = 0;
+   result.firth = false;
+
+   if (screen.sparse)
+   {
+      result.firth = true;
+   }
+   if (screen.fisher)
+   {
+      result.flags |= flag_fisher;
+   }
+   else if (screen.chi_large)
+   {
+      result.flags |= flag_chi_large;
+   }
+   if (result.chisq_p < parameters.chi_cutoff)
+   {
+      if (bact.covars_set())
+      {
+         return true;
+      }
 
-   std::stringstream line_stream(line);
-   std::string value;
+      // Without covariates the fit only depends on the contingency table
+      groupedLogit(result, screen.table, threadWorkspace().coefficients, fit_cache);
 
-   while(std::getline(line_stream, value, ','))
+      // Likelihood ratio test
+      result.lrt_p = likelihoodRatioTest(result);
+   }
+
+   return false;
+}
+
+// Adds a written result to the counts of pairs passing each stage
+void countResult(const PairResult& result, const cmdOptions& parameters, pairCounts& counts)
+{
+   counts.read_pairs++;
+   if (result.chisq_p < parameters.chi_cutoff)
    {
-      variant.push_back(value);
+      counts.tested_pairs++;
+      if (result.lrt_p < parameters.log_cutoff)
+      {
+         counts.significant_pairs++;
+      }
    }
-   return variant;
 }
 
+// Finds the unique patterns in a block of human variants, in order of first
+// appearance. Returns the pattern of each variant in the block
+std::vector<size_t> dedupHumanBlock(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, std::vector<std::shared_ptr<const HumanVariant>>& human_patterns)
+{
+   std::vector<size_t> pattern_of(human_block.size());
+   std::unordered_multimap<uint64_t, size_t> pattern_index;
+   for (size_t j = 0; j < human_block.size(); ++j)
+   {
+      uint64_t hash = human_block[j]->pattern_hash();
+      pattern_of[j] = human_patterns.size();
+
+      auto matches = pattern_index.equal_range(hash);
+      for (auto match = matches.first; match != matches.second; ++match)
+      {
+         if (human_block[j]->same_pattern(*human_patterns[match->second]))
+         {
+            pattern_of[j] = match->second;
+            break;
+         }
+      }
+
+      if (pattern_of[j] == human_patterns.size())
+      {
+         pattern_index.emplace(hash, human_patterns.size());
+         human_patterns.push_back(human_block[j]);
+      }
+   }
+
+   return pattern_of;
+}
@@ -17,6 +17,10 @@
 #include <iterator>
 #include <vector>
 #include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <thread>
 #include <exception>
 #include <sys/stat.h>
@@ -31,15 +35,22 @@
 #include <boost/math/distributions/chi_squared.hpp>
 
 // Armadillo/dlib headers
-#define ARMA_DONT_PRINT_ERRORS
-#include <armadillo>
+#include "armadilloConfig.hpp"
 #include <dlib/matrix.h>
 
 // dlib headers
 #include <dlib/optimization.h>
 
 // Classes
-#include "pair.hpp"
+#include "humanVariant.hpp"
+#include "bacterialVariant.hpp"
+#include "pairResult.hpp"
+#include "threadPool.hpp"
+#include "humanReader.hpp"
+#include "genotypeFile.hpp"
+#include "bedFile.hpp"
+#include "lineReader.hpp"
+#include "tableCache.hpp"
 
 // Constants
 extern const std::string VERSION;
@@ -47,10 +58,17 @@ extern const std::string maf_default;
 extern const std::string missing_default;
 extern const std::string chisq_default;
 extern const std::string pval_default;
+extern const std::string kernel_default;
+extern const std::string screen_default;
 extern const double convergence_limit;
 extern const unsigned int max_nr_iterations;
 extern const double se_limit;
 extern const double bfgs_start_beta;
+extern const size_t pair_block_size;
+extern const size_t bacterial_batch_size;
+extern const size_t table_cache_size;
+extern const size_t logit_batch_size;
+extern const int human_block_default;
 
 typedef dlib::matrix<double,0,1> column_vector;
 
@@ -67,38 +85,199 @@ struct cmdOptions
    long int chunk_start;
    long int chunk_end;
 
+   unsigned int num_threads;
+   unsigned int human_block;
+   std::string kernel;
+   std::string screen;
+   bool orthogonalise;
+
    std::string bact_file;
    std::string human_file;
    std::string output_file;
    std::string struct_file;
+   std::string null_cache;
+   std::string region;
+   std::string sample_file;
+};
+
+// Counts for a pair
+//          human 0   human 1   human 2
+// bact 0   a         b         c
+// bact 1   d         e         f
+struct contingencyTable
+{
+   uint32_t a, b, c;
+   uint32_t d, e, f;
+};
+
+// Outcome of testing a contingency table
+struct tableTest
+{
+   contingencyTable table;
+   double p_value;
+   double statistic;
+   bool sparse; // needs Firth regression
+   bool fisher; // p_value is from Fisher's exact test
+   bool chi_large;
+};
+
+// A line of input, and the unique pattern it is tested as
+struct patternLine
+{
+   long int line;
+   size_t pattern;
+};
+
+// Outcome of Newton-Raphson iterations
+enum irlsStatus
+{
+   irls_converged,
+   irls_not_converged,
+   irls_inv_fail
+};
+
+// A finished fit of one pair in a batch
+struct batchFit
+{
+   irlsStatus status;
+   arma::vec b;
+   arma::mat var_covar_mat;
+};
+
+// Buffers reused by every fit on a thread. They are sized for the largest
+// model seen, so once warm, testing pairs does not allocate for them
+struct fitWorkspace
+{
+   arma::vec y_train;
+   arma::mat x_design;
+   arma::vec coefficients;
+   arma::vec sample_work; // one element per sample
+
+   // Batched fits, with one column per pair
+   arma::mat x_products;
+   arma::mat batch_y;
+   arma::mat batch_start;
+   arma::mat batch_probs;
+   arma::mat batch_weights;
+   arma::mat batch_residuals;
+   arma::mat batch_information;
+   arma::mat batch_packed_var_covar;
+   arma::mat batch_leverages;
+   arma::mat batch_score;
+   arma::mat batch_unpacked;
+   arma::vec batch_step;
+   arma::vec batch_schur;
+   std::vector<const arma::mat*> batch_null_inverses;
+   std::vector<arma::mat> batch_var_covar_mats;
+   std::vector<size_t> batch_order;
+   std::vector<char> batch_finished;
+   std::vector<batchFit> batch_fits;
+   std::vector<size_t> plain_pairs;
+   std::vector<size_t> firth_pairs;
+};
+
+// Null model terms of every bacterial variant used by the score screen.
+// Column i of residuals and weights belongs to all_bacteria[i]
+struct scoreTerms
+{
+   arma::mat x_null;
+   arma::mat residuals;
+   arma::mat weights;
+};
+
+// Work done by fits with covariates
+struct fitCounts
+{
+   uint64_t pinv_fallbacks;
+   uint64_t newton_iterations;
+   uint64_t likelihood_evaluations;
+};
+
+// A covariate-free fit, which only depends on the contingency table
+struct groupedFit
+{
+   double log_likelihood;
+   double beta;
+   double se;
+   double lrt_p;
+   uint32_t flags;
+   uint32_t num_coefficients;
+   double coefficients[2];
+};
+
+struct pairCounts
+{
+   long int read_pairs;
+   long int tested_pairs;
+   long int significant_pairs;
 };
 
 // Function headers for each cpp file
 
 // epistasis.cpp
-std::vector<std::string> readCsvLine(std::istream& is);
+bool testPair(const HumanVariant& human, const BacterialVariant& bact, const tableTest& screen, const cmdOptions& parameters, TableCache<groupedFit>& fit_cache, PairResult& result);
+void countResult(const PairResult& result, const cmdOptions& parameters, pairCounts& counts);
+std::vector<size_t> dedupHumanBlock(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, std::vector<std::shared_ptr<const HumanVariant>>& human_patterns);
+
+// bacterialVariants.cpp
+long int readBacterialVariants(const cmdOptions& parameters, const size_t num_samples, const std::shared_ptr<const arma::mat>& mds, ThreadPool& pool, std::vector<BacterialVariant>& all_bacteria, std::vector<patternLine>& bact_lines);
+
+// nullCache.cpp
+uint64_t nullCacheKey(const cmdOptions& parameters);
+bool nullCacheMatches(const std::string& cache_file, const uint64_t key);
+bool readNullCache(const std::string& cache_file, const uint64_t key, std::vector<BacterialVariant>& all_bacteria);
+void writeNullCache(const std::string& cache_file, const uint64_t key, const std::vector<BacterialVariant>& all_bacteria);
+
+// genotypeParser.cpp
+bool readCsvLine(std::istream& is, std::string& line);
+bool readCsvLine(LineReader& reader, std::string& line);
+size_t countCsvFields(const std::string& line);
+void decodeHumanLine(const std::string& line, const long int line_nr, const size_t num_samples, std::vector<uint8_t>& genotypes);
+void decodeBacterialLine(const std::string& line, const long int line_nr, const size_t num_samples, std::vector<uint8_t>& genotypes);
 
 // common.cpp
 cmdOptions verifyCommandLine(boost::program_options::variables_map& vm, double num_samples);
 arma::vec dlib_to_arma(const column_vector& dlib_vec);
 column_vector arma_to_dlib(const arma::vec& arma_vec);
 arma::mat inv_covar(arma::mat A);
+void countNewtonIterations(const uint64_t iterations);
+void countLikelihoodEvaluation();
+fitCounts fitCounters();
+bool orthogonaliseCovariates(arma::mat& covariates);
 int fileStat(const std::string& filename);
+#ifdef SEER_DEBUG
+uint64_t threadHeapAllocations();
+#endif
 
 // cmdLine.cpp
 int parseCommandLine (int argc, char *argv[], boost::program_options::variables_map& vm);
 void printHelp(boost::program_options::options_description& help);
 
 // logisticRegression.cpp
-void doLogit(Pair& p);
-void newtonRaphson(Pair& p, const arma::vec& y_train, const arma::mat& x_design, const bool firth);
+void designMatrix(const arma::mat& x, const BacterialVariant& bact, arma::mat& x_design);
+void doLogit(PairResult& p, const arma::vec& y_train, const arma::mat& x_design, arma::vec& coefficients);
+void newtonRaphson(PairResult& p, const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& coefficients);
+fitWorkspace& threadWorkspace();
+irlsStatus irls(const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& b, arma::mat& var_covar_mat, unsigned int& iterations);
 arma::mat varCovarMat(const arma::mat& x, const arma::mat& b);
 arma::vec predictLogitProbs(const arma::mat& x, const arma::vec& b);
 
+// batchedRegression.cpp
+void batchedLogit(const HumanVariant& human, const std::vector<BacterialVariant>& all_bacteria, const std::vector<size_t>& pairs, const size_t start, const size_t end, std::vector<PairResult>& results);
+
+// groupedRegression.cpp
+void groupedLogit(PairResult& p, const contingencyTable& table, arma::vec& coefficients);
+void groupedLogit(PairResult& p, const contingencyTable& table, arma::vec& coefficients, TableCache<groupedFit>& fit_cache);
+
 // stats.cpp
-double chiTest(Pair& p);
-void set_null_ll(Pair& p);
-double likelihoodRatioTest(Pair& p);
+contingencyTable countTable(const HumanVariant& human, const BacterialVariant& bact);
+tableKey tableCacheKey(const contingencyTable& table);
+void chiTest(const std::vector<contingencyTable>& tables, std::vector<tableTest>& results, TableCache<double>& fisher_cache, const bool fisher_p = true);
+std::shared_ptr<const scoreTerms> nullScoreTerms(const std::vector<BacterialVariant>& all_bacteria, ThreadPool& pool);
+void scoreTest(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, const std::vector<BacterialVariant>& all_bacteria, const scoreTerms& terms, const size_t start, const size_t end, std::vector<tableTest>& results);
+void screenBlock(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, const std::vector<BacterialVariant>& all_bacteria, const std::shared_ptr<const scoreTerms>& score_terms, std::vector<tableTest>& screen, TableCache<double>& fisher_cache, ThreadPool& pool);
+void set_null_ll(BacterialVariant& bact);
+double likelihoodRatioTest(PairResult& p);
 double normalPval(double testStatistic);
 
 // fisher.cpp
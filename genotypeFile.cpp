@@ -0,0 +1,172 @@
+/*
+ * File: genotypeFile.cpp
+ *
+ * Reading and writing of the packed binary genotype format
+ *
+ */
+
+#include "genotypeFile.hpp"
+
+// mmap headers
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Checks whether a file starts with the magic number of the binary format
+bool isGenotypeFile(const std::string& filename)
+{
+   std::ifstream in(filename.c_str(), std::ios::binary);
+   char magic[sizeof(genotype_file_magic)];
+   if (!in.read(magic, sizeof(magic)))
+   {
+      return false;
+   }
+   return memcmp(magic, genotype_file_magic, sizeof(magic)) == 0;
+}
+
+MappedFile::MappedFile(const std::string& filename)
+   :_map(MAP_FAILED), _map_size(0)
+{
+   int fd = open(filename.c_str(), O_RDONLY);
+   if (fd < 0)
+   {
+      throw std::runtime_error("Could not open " + filename);
+   }
+
+   struct stat file_stat;
+   if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0)
+   {
+      close(fd);
+      throw std::runtime_error("Could not map empty file " + filename);
+   }
+   _map_size = file_stat.st_size;
+
+   _map = mmap(nullptr, _map_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (_map == MAP_FAILED)
+   {
+      throw std::runtime_error("Could not map " + filename);
+   }
+}
+
+MappedFile::~MappedFile()
+{
+   if (_map != MAP_FAILED)
+   {
+      munmap(_map, _map_size);
+   }
+}
+
+GenotypeFile::GenotypeFile(const std::string& filename)
+   :_map(filename), _header(nullptr), _records(nullptr), _info(nullptr)
+{
+   if (_map.size() < genotype_file_header_size)
+   {
+      throw std::runtime_error("Genotype file " + filename + " is too small to be valid");
+   }
+
+   // Check the header, and that the file is as long as it says
+   _header = reinterpret_cast<const genotypeFileHeader*>(_map.data());
+   size_t record_bytes = _header->planes_per_record * _header->words_per_plane * sizeof(uint64_t);
+   if (memcmp(_header->magic, genotype_file_magic, sizeof(genotype_file_magic)) != 0 || _header->version != genotype_file_version)
+   {
+      throw std::runtime_error(filename + " is not a version " + std::to_string(genotype_file_version) + " genotype file");
+   }
+   else if (_header->words_per_plane != planeWords(_header->num_samples)
+         || _header->info_offset != genotype_file_header_size + _header->num_variants * record_bytes
+         || _map.size() < _header->info_offset + _header->num_variants * sizeof(variantInfo))
+   {
+      throw std::runtime_error("Genotype file " + filename + " is truncated or corrupt");
+   }
+
+   _records = reinterpret_cast<const uint64_t*>(_map.data() + genotype_file_header_size);
+   _info = reinterpret_cast<const variantInfo*>(_map.data() + _header->info_offset);
+}
+
+GenotypeFileWriter::GenotypeFileWriter(const std::string& filename, const genotypeFileType type, const size_t num_samples)
+   :_out(filename.c_str(), std::ios::binary | std::ios::trunc)
+{
+   if (!_out)
+   {
+      throw std::runtime_error("Could not write to genotype file " + filename);
+   }
+
+   memset(&_header, 0, sizeof(_header));
+   memcpy(_header.magic, genotype_file_magic, sizeof(genotype_file_magic));
+   _header.version = genotype_file_version;
+   _header.type = type;
+   _header.num_samples = num_samples;
+   _header.words_per_plane = planeWords(num_samples);
+   _header.planes_per_record = type == human_genotypes ? 3 : 2;
+
+   _planes.resize(_header.planes_per_record, bitPlane(_header.words_per_plane));
+
+   // Header is rewritten with the final counts on close
+   std::vector<char> header_block(genotype_file_header_size, 0);
+   _out.write(header_block.data(), header_block.size());
+}
+
+void GenotypeFileWriter::add_variant(const std::vector<uint8_t>& genotypes)
+{
+   if (genotypes.size() != _header.num_samples)
+   {
+      throw std::runtime_error("genotype file: sample size incorrect\n");
+   }
+
+   for (auto it = _planes.begin(); it != _planes.end(); ++it)
+   {
+      std::fill(it->begin(), it->end(), 0);
+   }
+
+   // Human planes are 0/1, 1/1, missing. Bacterial are present, missing
+   bitPlane& missing_plane = _planes.back();
+   for (size_t i = 0; i < genotypes.size(); ++i)
+   {
+      if (genotypes[i] == genotype_missing)
+      {
+         setPlaneBit(missing_plane, i);
+      }
+      else if (genotypes[i] > 0 && genotypes[i] < _planes.size())
+      {
+         setPlaneBit(_planes[genotypes[i] - 1], i);
+      }
+   }
+
+   variantInfo info;
+   if (_header.type == human_genotypes)
+   {
+      info.maf = (double)(popcountPlane(_planes[0]) + 2*popcountPlane(_planes[1]))/_header.num_samples;
+   }
+   else
+   {
+      info.maf = (double)popcountPlane(_planes[0])/_header.num_samples;
+   }
+   info.missing = (double)popcountPlane(missing_plane)/_header.num_samples;
+   _info.push_back(info);
+
+   for (auto it = _planes.begin(); it != _planes.end(); ++it)
+   {
+      _out.write(reinterpret_cast<const char*>(it->data()), it->size() * sizeof(uint64_t));
+   }
+   if (!_out)
+   {
+      throw std::runtime_error("Error writing genotype file");
+   }
+}
+
+void GenotypeFileWriter::close()
+{
+   _header.num_variants = _info.size();
+   _header.info_offset = genotype_file_header_size + _header.num_variants * _header.planes_per_record * _header.words_per_plane * sizeof(uint64_t);
+
+   _out.write(reinterpret_cast<const char*>(_info.data()), _info.size() * sizeof(variantInfo));
+   _out.seekp(0);
+   _out.write(reinterpret_cast<const char*>(&_header), sizeof(_header));
+   _out.close();
+
+   if (!_out)
+   {
+      throw std::runtime_error("Error writing genotype file");
+   }
+}
@@ -0,0 +1,134 @@
+/*
+ * genotypeFile.hpp
+ * Header file for the packed binary genotype format
+ *
+ * Layout (all little-endian):
+ *    header       genotypeFileHeader, padded to 64 bytes
+ *    records      one per variant, each planes_per_record bit planes of
+ *                 words_per_plane 64-bit words
+ *    variant info one variantInfo per variant, at info_offset
+ *
+ * Human records hold the 0/1, 1/1 and missing planes, bacterial records the
+ * present and missing planes. The records are at a fixed stride, so a
+ * variant can be found without reading the ones before it
+ *
+ */
+#ifndef GENOTYPE_FILE_HPP
+#define GENOTYPE_FILE_HPP
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <exception>
+#include <stdexcept>
+
+// Packed planes
+#include "genotypeKernels.hpp"
+
+const char genotype_file_magic[8] = {'E', 'P', 'I', 'G', 'E', 'N', 'O', '1'};
+const uint32_t genotype_file_version = 1;
+const uint64_t genotype_file_header_size = 64;
+
+enum genotypeFileType : uint32_t
+{
+   human_genotypes = 0,
+   bacterial_genotypes = 1
+};
+
+struct genotypeFileHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t type;
+   uint64_t num_samples;
+   uint64_t num_variants;
+   uint64_t words_per_plane;
+   uint64_t planes_per_record;
+   uint64_t info_offset;
+};
+
+struct variantInfo
+{
+   double maf;
+   double missing;
+};
+
+// A whole file memory mapped read only, so concurrent jobs on a node share
+// the page cache
+class MappedFile
+{
+   public:
+      // Initialisation
+      MappedFile(const std::string& filename); // this is defined in genotypeFile.cpp
+      ~MappedFile();
+
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
+
+      // nonmodifying operations
+      const char* data() const { return static_cast<const char*>(_map); }
+      size_t size() const { return _map_size; }
+
+   private:
+      void* _map;
+      size_t _map_size;
+};
+
+// Read only view of a packed genotype file
+class GenotypeFile
+{
+   public:
+      // Initialisation
+      GenotypeFile(const std::string& filename); // this is defined in genotypeFile.cpp
+
+      // nonmodifying operations
+      genotypeFileType type() const { return (genotypeFileType)_header->type; }
+      size_t samples() const { return _header->num_samples; }
+      size_t variants() const { return _header->num_variants; }
+      size_t plane_words() const { return _header->words_per_plane; }
+      const variantInfo& info(const size_t variant) const { return _info[variant]; }
+
+      // Plane number plane of a variant (both 0-indexed)
+      const uint64_t* plane(const size_t variant, const size_t plane) const
+      {
+         return _records + (variant * _header->planes_per_record + plane) * _header->words_per_plane;
+      }
+
+   private:
+      MappedFile _map;
+
+      const genotypeFileHeader* _header;
+      const uint64_t* _records;
+      const variantInfo* _info;
+};
+
+// Writes variants to a new file one at a time
+class GenotypeFileWriter
+{
+   public:
+      // Initialisation
+      GenotypeFileWriter(const std::string& filename, const genotypeFileType type, const size_t num_samples); // this is defined in genotypeFile.cpp
+
+      // Adds the next variant, from decoded genotype codes
+      void add_variant(const std::vector<uint8_t>& genotypes);
+
+      // Writes the variant info and completes the header
+      void close();
+
+      size_t variants() const { return _info.size(); }
+
+   private:
+      std::ofstream _out;
+      genotypeFileHeader _header;
+      std::vector<variantInfo> _info;
+      std::vector<bitPlane> _planes;
+};
+
+// genotypeFile.cpp
+bool isGenotypeFile(const std::string& filename);
+
+#endif
@@ -0,0 +1,306 @@
+/*
+ * File: genotypeKernels.cpp
+ *
+ * Counting operations on bit packed genotype planes
+ * There is a version of each kernel for each instruction set. The best
+ * one the CPU supports is picked at startup, unless overridden
+ *
+ */
+
+#include "genotypeKernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EPISTASIS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Scalar versions. Count bits in parallel within each word, so no
+// instruction set extensions are needed
+static inline size_t swarPopcount(uint64_t word)
+{
+   word = word - ((word >> 1) & 0x5555555555555555ULL);
+   word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+   word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+   return (word * 0x0101010101010101ULL) >> 56;
+}
+
+static size_t popcountScalar(const uint64_t* words, const size_t num_words)
+{
+   size_t count = 0;
+   for (size_t i = 0; i < num_words; ++i)
+   {
+      count += swarPopcount(words[i]);
+   }
+   return count;
+}
+
+static size_t andPopcountScalar(const uint64_t* words_a, const uint64_t* words_b, const size_t num_words)
+{
+   size_t count = 0;
+   for (size_t i = 0; i < num_words; ++i)
+   {
+      count += swarPopcount(words_a[i] & words_b[i]);
+   }
+   return count;
+}
+
+#ifdef EPISTASIS_X86_KERNELS
+// SSE4.2 versions, using the hardware popcnt instruction
+__attribute__((target("popcnt")))
+static size_t popcountSse42(const uint64_t* words, const size_t num_words)
+{
+   size_t count = 0;
+   for (size_t i = 0; i < num_words; ++i)
+   {
+      count += __builtin_popcountll(words[i]);
+   }
+   return count;
+}
+
+__attribute__((target("popcnt")))
+static size_t andPopcountSse42(const uint64_t* words_a, const uint64_t* words_b, const size_t num_words)
+{
+   size_t count = 0;
+   for (size_t i = 0; i < num_words; ++i)
+   {
+      count += __builtin_popcountll(words_a[i] & words_b[i]);
+   }
+   return count;
+}
+
+// AVX2 versions. Looks up the count of each nibble with a byte shuffle,
+// then sums bytes into 64-bit lanes
+// See: doi:10.1093/comjnl/bxx046
+__attribute__((target("avx2")))
+static inline __m256i popcountAvx2Lanes(const __m256i v)
+{
+   const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+   const __m256i low_mask = _mm256_set1_epi8(0x0f);
+
+   __m256i lo = _mm256_and_si256(v, low_mask);
+   __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+   __m256i byte_counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+
+   return _mm256_sad_epu8(byte_counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline size_t sumAvx2Lanes(const __m256i v)
+{
+   return _mm256_extract_epi64(v, 0) + _mm256_extract_epi64(v, 1) + _mm256_extract_epi64(v, 2) + _mm256_extract_epi64(v, 3);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t popcountAvx2(const uint64_t* words, const size_t num_words)
+{
+   __m256i total = _mm256_setzero_si256();
+   size_t i = 0;
+   for (; i + 4 <= num_words; i += 4)
+   {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+      total = _mm256_add_epi64(total, popcountAvx2Lanes(v));
+   }
+
+   size_t count = sumAvx2Lanes(total);
+   for (; i < num_words; ++i)
+   {
+      count += __builtin_popcountll(words[i]);
+   }
+   return count;
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t andPopcountAvx2(const uint64_t* words_a, const uint64_t* words_b, const size_t num_words)
+{
+   __m256i total = _mm256_setzero_si256();
+   size_t i = 0;
+   for (; i + 4 <= num_words; i += 4)
+   {
+      __m256i v = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words_a + i)),
+                                   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words_b + i)));
+      total = _mm256_add_epi64(total, popcountAvx2Lanes(v));
+   }
+
+   size_t count = sumAvx2Lanes(total);
+   for (; i < num_words; ++i)
+   {
+      count += __builtin_popcountll(words_a[i] & words_b[i]);
+   }
+   return count;
+}
+
+// AVX-512 versions, using the VPOPCNTDQ per-lane popcount
+__attribute__((target("avx512f")))
+static inline size_t sumAvx512Lanes(const __m512i v)
+{
+   uint64_t lanes[8];
+   _mm512_storeu_si512(lanes, v);
+   return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t popcountAvx512(const uint64_t* words, const size_t num_words)
+{
+   __m512i total = _mm512_setzero_si512();
+   size_t i = 0;
+   for (; i + 8 <= num_words; i += 8)
+   {
+      total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+   }
+   if (i < num_words)
+   {
+      __mmask8 tail = (__mmask8)((1U << (num_words - i)) - 1);
+      total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(tail, words + i)));
+   }
+   return sumAvx512Lanes(total);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static size_t andPopcountAvx512(const uint64_t* words_a, const uint64_t* words_b, const size_t num_words)
+{
+   __m512i total = _mm512_setzero_si512();
+   size_t i = 0;
+   for (; i + 8 <= num_words; i += 8)
+   {
+      __m512i v = _mm512_and_si512(_mm512_loadu_si512(words_a + i), _mm512_loadu_si512(words_b + i));
+      total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+   }
+   if (i < num_words)
+   {
+      __mmask8 tail = (__mmask8)((1U << (num_words - i)) - 1);
+      __m512i v = _mm512_and_si512(_mm512_maskz_loadu_epi64(tail, words_a + i), _mm512_maskz_loadu_epi64(tail, words_b + i));
+      total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+   }
+   return sumAvx512Lanes(total);
+}
+#endif
+
+// Table of available kernels, in order of preference
+static const kernelSet all_kernels[] = {
+#ifdef EPISTASIS_X86_KERNELS
+   {"avx512", popcountAvx512, andPopcountAvx512},
+   {"avx2", popcountAvx2, andPopcountAvx2},
+   {"sse42", popcountSse42, andPopcountSse42},
+#endif
+   {"scalar", popcountScalar, andPopcountScalar}
+};
+static const size_t num_kernels = sizeof(all_kernels) / sizeof(all_kernels[0]);
+
+// Default to the scalar kernels until selectKernels is called
+static const kernelSet* active_kernels = &all_kernels[num_kernels - 1];
+
+// Whether the CPU running this can use a kernel set
+static bool kernelSupported(const kernelSet& kernels)
+{
+   std::string name = kernels.name;
+#ifdef EPISTASIS_X86_KERNELS
+   __builtin_cpu_init();
+   if (name == "avx512")
+   {
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq");
+   }
+   else if (name == "avx2")
+   {
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+   }
+   else if (name == "sse42")
+   {
+      return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+   }
+#endif
+   return name == "scalar";
+}
+
+// Pick the kernels to use. "auto" chooses the best the CPU supports.
+// Should be called before any threads are started
+const kernelSet& selectKernels(const std::string& name)
+{
+   const kernelSet* chosen = nullptr;
+   for (size_t i = 0; i < num_kernels; ++i)
+   {
+      if ((name == "auto" || name == all_kernels[i].name) && kernelSupported(all_kernels[i]))
+      {
+         chosen = &all_kernels[i];
+         break;
+      }
+   }
+
+   if (chosen == nullptr)
+   {
+      throw std::runtime_error("kernel " + name + " is not available on this CPU");
+   }
+   active_kernels = chosen;
+
+   return *active_kernels;
+}
+
+const kernelSet& activeKernels()
+{
+   return *active_kernels;
+}
+
+// Runs every kernel this CPU supports over the same planes, and checks
+// they agree with the scalar version
+bool crossCheckKernels()
+{
+   // Lengths cover the vector bodies and the scalar tails
+   bool agree = true;
+   uint64_t state = 0x9e3779b97f4a7c15ULL;
+   for (size_t num_words = 0; num_words < 40; ++num_words)
+   {
+      bitPlane plane_a(num_words), plane_b(num_words);
+      for (size_t i = 0; i < num_words; ++i)
+      {
+         state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+         plane_a[i] = state;
+         state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+         plane_b[i] = state;
+      }
+
+      size_t expected = popcountScalar(plane_a.data(), num_words);
+      size_t expected_and = andPopcountScalar(plane_a.data(), plane_b.data(), num_words);
+      for (size_t i = 0; i < num_kernels; ++i)
+      {
+         if (kernelSupported(all_kernels[i]) &&
+               (all_kernels[i].popcount(plane_a.data(), num_words) != expected ||
+                all_kernels[i].and_popcount(plane_a.data(), plane_b.data(), num_words) != expected_and))
+         {
+            std::cerr << "Kernel " << all_kernels[i].name << " disagrees with scalar kernel on " << num_words << " words\n";
+            agree = false;
+         }
+      }
+   }
+
+   return agree;
+}
+
+// Number of 64-bit words needed to hold one bit per sample
+size_t planeWords(const size_t num_samples)
+{
+   return (num_samples + 63) / 64;
+}
+
+// Number of set bits in a plane
+size_t popcountPlane(const bitPlane& plane)
+{
+   return active_kernels->popcount(plane.data(), plane.size());
+}
+
+// Number of samples set in both planes, which must be the same length
+size_t andPopcountPlanes(const bitPlane& plane_a, const bitPlane& plane_b)
+{
+   return active_kernels->and_popcount(plane_a.data(), plane_b.data(), plane_a.size());
+}
+
+// Hash of the pattern in a plane, for finding identical variants. Chain
+// calls to hash several planes together
+uint64_t hashPlane(const bitPlane& plane, uint64_t hash)
+{
+   for (auto it = plane.begin(); it != plane.end(); ++it)
+   {
+      hash = (hash ^ *it) * 1099511628211ULL;
+      hash ^= hash >> 29;
+   }
+   return hash;
+}
@@ -0,0 +1,44 @@
+/*
+ * genotypeKernels.hpp
+ * Bit packed genotype planes, and the counting kernels used on them
+ *
+ */
+#ifndef GENOTYPE_KERNELS_HPP
+#define GENOTYPE_KERNELS_HPP
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+// Code used for missing genotypes when decoding. Others are the count of
+// non-reference alleles
+const uint8_t genotype_missing = 3;
+
+// One bit per sample, packed into 64-bit words. Bits past the last sample
+// are always zero
+typedef std::vector<uint64_t> bitPlane;
+
+// One implementation of the counting kernels, for a particular instruction set
+struct kernelSet
+{
+   const char* name;
+   size_t (*popcount)(const uint64_t* words, const size_t num_words);
+   size_t (*and_popcount)(const uint64_t* words_a, const uint64_t* words_b, const size_t num_words);
+};
+
+// genotypeKernels.cpp
+const kernelSet& selectKernels(const std::string& name);
+const kernelSet& activeKernels();
+bool crossCheckKernels();
+size_t planeWords(const size_t num_samples);
+inline void setPlaneBit(bitPlane& plane, const size_t sample) { plane[sample >> 6] |= (uint64_t)1 << (sample & 63); }
+inline bool planeBit(const bitPlane& plane, const size_t sample) { return (plane[sample >> 6] >> (sample & 63)) & 1; }
+size_t popcountPlane(const bitPlane& plane);
+uint64_t hashPlane(const bitPlane& plane, uint64_t hash = 14695981039346656037ULL);
+size_t andPopcountPlanes(const bitPlane& plane_a, const bitPlane& plane_b);
+
+#endif
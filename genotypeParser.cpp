@@ -0,0 +1,179 @@
+/*
+ * File: genotypeParser.cpp
+ *
+ * Byte level tokenising of the csv genotype files
+ * Lines are read into a buffer which is reused, and each token is decoded
+ * straight to a genotype code without creating a string for it
+ *
+ */
+
+#include "epistasis.hpp"
+
+// Reads the next line into a reusable buffer. Returns false at end of file
+bool readCsvLine(std::istream& is, std::string& line)
+{
+   std::getline(is, line);
+   if (!is)
+   {
+      return false;
+   }
+
+   // Tolerate windows line endings
+   if (!line.empty() && line.back() == '\r')
+   {
+      line.pop_back();
+   }
+   return true;
+}
+
+bool readCsvLine(LineReader& reader, std::string& line)
+{
+   if (!reader.getline(line))
+   {
+      return false;
+   }
+
+   if (!line.empty() && line.back() == '\r')
+   {
+      line.pop_back();
+   }
+   return true;
+}
+
+// Number of comma separated fields in a line
+size_t countCsvFields(const std::string& line)
+{
+   if (line.empty())
+   {
+      return 0;
+   }
+   return std::count(line.begin(), line.end(), ',') + 1;
+}
+
+// Reports a token which could not be decoded
+static void malformedToken(const std::string& file_type, const std::string& line, const long int line_nr, const size_t column, const size_t sample)
+{
+   size_t token_end = line.find(',', column);
+   if (token_end == std::string::npos)
+   {
+      token_end = line.size();
+   }
+
+   throw std::runtime_error(file_type + " snps: malformed genotype '" + line.substr(column, token_end - column)
+         + "' at line " + std::to_string(line_nr) + ", column " + std::to_string(column + 1)
+         + " (sample " + std::to_string(sample + 1) + ")");
+}
+
+// Reports a line with the wrong number of samples
+static void wrongSampleCount(const std::string& file_type, const long int line_nr, const size_t num_samples)
+{
+   throw std::runtime_error(file_type + " snps: sample size incorrect at line " + std::to_string(line_nr)
+         + ", expected " + std::to_string(num_samples) + " samples");
+}
+
+// Decodes a line of human genotypes (0/0, 0/1, 1/1 or ./.) to 0, 1, 2 or
+// genotype_missing
+void decodeHumanLine(const std::string& line, const long int line_nr, const size_t num_samples, std::vector<uint8_t>& genotypes)
+{
+   genotypes.resize(num_samples);
+
+   const char* start = line.data();
+   const char* end = start + line.size();
+   const char* pos = start;
+
+   size_t sample = 0;
+   while (pos < end)
+   {
+      if (sample >= num_samples)
+      {
+         wrongSampleCount("human", line_nr, num_samples);
+      }
+
+      // Every valid token is exactly three characters, followed by a
+      // separator or the end of the line
+      if (end - pos < 3 || pos[1] != '/' || (pos + 3 < end && pos[3] != ','))
+      {
+         malformedToken("human", line, line_nr, pos - start, sample);
+      }
+
+      const char allele_1 = pos[0], allele_2 = pos[2];
+      if (allele_1 == '0' && allele_2 == '0')
+      {
+         genotypes[sample] = 0;
+      }
+      else if (allele_1 == '0' && allele_2 == '1')
+      {
+         genotypes[sample] = 1;
+      }
+      else if (allele_1 == '1' && allele_2 == '1')
+      {
+         genotypes[sample] = 2;
+      }
+      else if (allele_1 == '.' && allele_2 == '.')
+      {
+         genotypes[sample] = genotype_missing;
+      }
+      else
+      {
+         malformedToken("human", line, line_nr, pos - start, sample);
+      }
+
+      sample++;
+      pos += 4;
+   }
+
+   // A trailing comma leaves an empty last field
+   if (sample != num_samples || (!line.empty() && line.back() == ','))
+   {
+      wrongSampleCount("human", line_nr, num_samples);
+   }
+}
+
+// Decodes a line of bacterial variants (0, 1 or .) to 0, 1 or
+// genotype_missing
+void decodeBacterialLine(const std::string& line, const long int line_nr, const size_t num_samples, std::vector<uint8_t>& genotypes)
+{
+   genotypes.resize(num_samples);
+
+   const char* start = line.data();
+   const char* end = start + line.size();
+   const char* pos = start;
+
+   size_t sample = 0;
+   while (pos < end)
+   {
+      if (sample >= num_samples)
+      {
+         wrongSampleCount("bacterial", line_nr, num_samples);
+      }
+
+      // Every valid token is one character
+      if (pos + 1 < end && pos[1] != ',')
+      {
+         malformedToken("bacterial", line, line_nr, pos - start, sample);
+      }
+
+      switch (*pos)
+      {
+         case '0':
+            genotypes[sample] = 0;
+            break;
+         case '1':
+            genotypes[sample] = 1;
+            break;
+         case '.':
+            genotypes[sample] = genotype_missing;
+            break;
+         default:
+            malformedToken("bacterial", line, line_nr, pos - start, sample);
+      }
+
+      sample++;
+      pos += 2;
+   }
+
+   if (sample != num_samples || (!line.empty() && line.back() == ','))
+   {
+      wrongSampleCount("bacterial", line_nr, num_samples);
+   }
+}
@@ -0,0 +1,250 @@
+/*
+ * File: groupedRegression.cpp
+ *
+ * Logistic regression of bacterial variant on human genotype when there are
+ * no covariates. The model then only depends on the 2x3 contingency table,
+ * so is fitted to the three genotype rows as binomial counts rather than to
+ * every sample
+ *
+ */
+
+#include "epistasis.hpp"
+
+// Each human genotype x = 0, 1, 2 as a row of n samples, k of which have the
+// bacterial variant
+struct groupedRows
+{
+   double x[3];
+   double n[3];
+   double k[3];
+};
+
+enum groupedFitStatus
+{
+   grouped_converged,
+   grouped_not_converged,
+   grouped_inv_fail
+};
+
+static groupedRows tableRows(const contingencyTable& table)
+{
+   groupedRows rows;
+   rows.x[0] = 0; rows.n[0] = table.a + table.d; rows.k[0] = table.d;
+   rows.x[1] = 1; rows.n[1] = table.b + table.e; rows.k[1] = table.e;
+   rows.x[2] = 2; rows.n[2] = table.c + table.f; rows.k[2] = table.f;
+
+   return rows;
+}
+
+static double rowProb(const arma::vec& b, const double x)
+{
+   return 1.0 / (1.0 + exp(-(b(0) + b(1) * x)));
+}
+
+// Same as LogitLikelihood summed over the samples
+static double groupedLikelihood(const groupedRows& rows, const arma::vec& b)
+{
+   double result = 0;
+   for (int g = 0; g < 3; ++g)
+   {
+      double p = rowProb(b, rows.x[g]);
+      if (rows.k[g] > 0)
+      {
+         result += rows.k[g] * log(p);
+      }
+      if (rows.n[g] > rows.k[g])
+      {
+         result += (rows.n[g] - rows.k[g]) * log(1.0 - p);
+      }
+   }
+   return result;
+}
+
+// Fisher information at b
+static arma::mat groupedInformation(const groupedRows& rows, const arma::vec& b)
+{
+   arma::mat I(2, 2, arma::fill::zeros);
+   for (int g = 0; g < 3; ++g)
+   {
+      double p = rowProb(b, rows.x[g]);
+      double w = rows.n[g] * p * (1 - p);
+      I(0,0) += w;
+      I(0,1) += w * rows.x[g];
+      I(1,1) += w * rows.x[g] * rows.x[g];
+   }
+   I(1,0) = I(0,1);
+
+   return I;
+}
+
+// Newton-Raphson iterations as in newtonRaphson, with the sums over samples
+// replaced by sums over the rows. var_covar_mat is from the last iteration
+static groupedFitStatus groupedNewton(const groupedRows& rows, const bool firth, arma::vec& b, arma::mat& var_covar_mat)
+{
+   double n = rows.n[0] + rows.n[1] + rows.n[2];
+   double mean_y = (rows.k[0] + rows.k[1] + rows.k[2]) / n;
+
+   b.zeros(2);
+   b(0) = log(mean_y/(1 - mean_y));
+
+   for (unsigned int i = 0; i < max_nr_iterations; ++i)
+   {
+      var_covar_mat = inv_covar(groupedInformation(rows, b));
+      if (var_covar_mat.n_cols == 0 || var_covar_mat.n_rows == 0)
+      {
+         return grouped_inv_fail;
+      }
+
+      arma::vec U(2, arma::fill::zeros);
+      for (int g = 0; g < 3; ++g)
+      {
+         double p = rowProb(b, rows.x[g]);
+         double residual = rows.k[g] - rows.n[g] * p;
+         if (firth)
+         {
+            // Diagonal of the hat matrix is the same for every sample in
+            // the row
+            double h = p * (1 - p) * (var_covar_mat(0,0) + 2 * rows.x[g] * var_covar_mat(0,1) + rows.x[g] * rows.x[g] * var_covar_mat(1,1));
+            residual += rows.n[g] * h * (0.5 - p);
+         }
+         U(0) += residual;
+         U(1) += residual * rows.x[g];
+      }
+
+      arma::vec b1 = b + var_covar_mat * U;
+      bool converged = std::abs(b1(1) - b(1)) < convergence_limit;
+      b = b1;
+      if (converged)
+      {
+         return grouped_converged;
+      }
+   }
+
+   return grouped_not_converged;
+}
+
+// Equivalent of newtonRaphson
+static void groupedNewtonRaphson(PairResult& p, const groupedRows& rows, const bool firth, arma::vec& coefficients)
+{
+   arma::vec b;
+   arma::mat var_covar_mat;
+   groupedFitStatus status = groupedNewton(rows, firth, b, var_covar_mat);
+
+   if (status == grouped_inv_fail)
+   {
+      p.flags |= flag_inv_fail;
+      p.lrt_p = 0;
+      std::cerr << "Inversion at input line " << p.bact_line << "," << p.human_line << " failed" << std::endl;
+   }
+   else if (status == grouped_not_converged)
+   {
+      if (!firth)
+      {
+         p.flags |= flag_nr_fail;
+         groupedNewtonRaphson(p, rows, 1, coefficients);
+      }
+      else
+      {
+         p.flags |= flag_firth_fail;
+      }
+   }
+   else
+   {
+      p.log_likelihood = groupedLikelihood(rows, b);
+      if (p.firth)
+      {
+         p.log_likelihood += 0.5*log(det(inv_covar(var_covar_mat)));
+      }
+
+      p.beta = b(1);
+      coefficients = b;
+
+      double se = pow(var_covar_mat(1,1), 0.5);
+      p.se = se;
+
+      // Deal with large SEs
+      if (se > se_limit)
+      {
+         if (!firth)
+         {
+            groupedNewtonRaphson(p, rows, 1, coefficients);
+         }
+         else
+         {
+            p.flags |= flag_large_se;
+         }
+      }
+
+      double W = std::abs(p.beta) / se;
+      p.lrt_p = normalPval(W);
+   }
+}
+
+// Equivalent of doLogit for a pair without covariates. Newton iterations
+// replace BFGS, reaching the same maximum. Where BFGS would run off towards
+// infinity (separation), Newton fails to converge or gives a large SE, and
+// both go on to Firth regression as a large SE does in doLogit
+void groupedLogit(PairResult& p, const contingencyTable& table, arma::vec& coefficients)
+{
+   coefficients.reset();
+   groupedRows rows = tableRows(table);
+
+   if (p.firth)
+   {
+      groupedNewtonRaphson(p, rows, 1, coefficients);
+      return;
+   }
+
+   arma::vec b;
+   arma::mat var_covar_mat;
+   if (groupedNewton(rows, 0, b, var_covar_mat) == grouped_converged)
+   {
+      // Information at the maximum, as varCovarMat gives after BFGS
+      var_covar_mat = inv_covar(groupedInformation(rows, b));
+      double se = var_covar_mat.n_rows == 2 ? pow(var_covar_mat(1,1), 0.5) : se_limit + 1;
+      if (se <= se_limit)
+      {
+         p.beta = b(1);
+         p.log_likelihood = groupedLikelihood(rows, b);
+         p.se = se;
+         p.lrt_p = normalPval(std::abs(b(1)) / se);
+         coefficients = b;
+         return;
+      }
+   }
+
+   p.flags |= flag_large_se;
+   groupedNewtonRaphson(p, rows, 1, coefficients);
+}
+
+// As above, reusing the fit of an identical table when there is one
+void groupedLogit(PairResult& p, const contingencyTable& table, arma::vec& coefficients, TableCache<groupedFit>& fit_cache)
+{
+   tableKey key = tableCacheKey(table);
+   groupedFit fit;
+   if (fit_cache.find(key, fit))
+   {
+      p.log_likelihood = fit.log_likelihood;
+      p.beta = fit.beta;
+      p.se = fit.se;
+      p.lrt_p = fit.lrt_p;
+      p.flags |= fit.flags;
+      coefficients = arma::vec(fit.coefficients, fit.num_coefficients);
+      return;
+   }
+
+   // The flags from screening are also set by the table, so only those
+   // added by the fit are stored
+   uint32_t screen_flags = p.flags;
+   groupedLogit(p, table, coefficients);
+
+   fit.log_likelihood = p.log_likelihood;
+   fit.beta = p.beta;
+   fit.se = p.se;
+   fit.lrt_p = p.lrt_p;
+   fit.flags = p.flags & ~screen_flags;
+   fit.num_coefficients = coefficients.n_elem;
+   std::copy(coefficients.begin(), coefficients.end(), fit.coefficients);
+   fit_cache.insert(key, fit);
+}
+
@@ -0,0 +1,230 @@
+/*
+ * File: humanReader.cpp
+ *
+ * Decompresses and decodes human variants on a separate thread, so the
+ * tests do not wait for zlib
+ *
+ */
+
+#include "epistasis.hpp"
+
+HumanReader::HumanReader(const std::string& human_file, const size_t num_samples, const long int chunk_start, const long int chunk_end, const size_t capacity, const std::shared_ptr<const BedFile>& bed_file)
+   :_num_samples(num_samples), _ring(std::max(capacity, (size_t)1)), _head(0), _count(0), _finished(false), _stop(false), _line_nr(1), _starved(0), _blocked(0)
+{
+   _reader = std::thread(&HumanReader::read_variants, this, human_file, bed_file, chunk_start, chunk_end);
+}
+
+HumanReader::~HumanReader()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+   }
+   _not_full.notify_all();
+   _reader.join();
+}
+
+bool HumanReader::next(std::shared_ptr<const HumanVariant>& human)
+{
+   std::unique_lock<std::mutex> lock(_mutex);
+   if (_count == 0 && !_finished)
+   {
+      _starved++;
+      _not_empty.wait(lock, [this]{ return _count > 0 || _finished; });
+   }
+
+   if (_count == 0)
+   {
+      if (_error)
+      {
+         std::rethrow_exception(_error);
+      }
+      return false;
+   }
+
+   human = std::move(_ring[_head]);
+   _head = (_head + 1) % _ring.size();
+   _count--;
+
+   lock.unlock();
+   _not_full.notify_one();
+
+   return true;
+}
+
+// Runs on the reading thread
+void HumanReader::read_variants(const std::string human_file, const std::shared_ptr<const BedFile> bed_file, const long int chunk_start, const long int chunk_end)
+{
+   long int line_nr = 1;
+   try
+   {
+      if (isGenotypeFile(human_file))
+      {
+         line_nr = read_binary(human_file, chunk_start, chunk_end);
+      }
+      else if (bed_file)
+      {
+         line_nr = read_bed(*bed_file, chunk_start, chunk_end);
+      }
+      else if (isBedFile(human_file))
+      {
+         line_nr = read_bed(BedFile(human_file), chunk_start, chunk_end);
+      }
+      else
+      {
+         line_nr = read_csv(human_file, chunk_start, chunk_end);
+      }
+   }
+   catch (...)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _error = std::current_exception();
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _line_nr = line_nr;
+      _finished = true;
+   }
+   _not_empty.notify_all();
+}
+
+// Adds a decoded variant to the ring buffer, waiting for space. Returns
+// false if the reader is being stopped
+bool HumanReader::push_variant(const std::shared_ptr<const HumanVariant>& human)
+{
+   {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_count == _ring.size() && !_stop)
+      {
+         _blocked++;
+         _not_full.wait(lock, [this]{ return _count < _ring.size() || _stop; });
+      }
+      if (_stop)
+      {
+         return false;
+      }
+
+      _ring[(_head + _count) % _ring.size()] = human;
+      _count++;
+   }
+   _not_empty.notify_one();
+
+   return true;
+}
+
+// Text input. Returns the final line number
+long int HumanReader::read_csv(const std::string& human_file, const long int chunk_start, const long int chunk_end)
+{
+   long int line_nr = 1;
+
+   LineReader human_in(human_file);
+
+   std::string line_buffer;
+   std::vector<uint8_t> genotype_buffer(_num_samples);
+
+   // Jump to the required block using the line index. Reading already
+   // starts at line 1
+   if (chunk_start > 0)
+   {
+      line_nr = chunk_start;
+      if (chunk_start > 1)
+      {
+         std::cerr << "Seeking to chunk position: line " << chunk_start << std::endl;
+         human_in.seek_line(chunk_start);
+      }
+   }
+
+   while (readCsvLine(human_in, line_buffer))
+   {
+      decodeHumanLine(line_buffer, line_nr, _num_samples, genotype_buffer);
+      if (!push_variant(std::make_shared<const HumanVariant>(genotype_buffer, line_nr)))
+      {
+         break;
+      }
+
+      if (chunk_end > 0 && line_nr >= chunk_end)
+      {
+         line_nr--;
+         break;
+      }
+      else
+      {
+         line_nr++;
+      }
+   }
+
+   return line_nr;
+}
+
+// Packed binary input. Records are at a fixed stride, so the chunk start
+// can be jumped to directly. Returns the final line number
+long int HumanReader::read_binary(const std::string& human_file, const long int chunk_start, const long int chunk_end)
+{
+   GenotypeFile human_in(human_file);
+   if (human_in.type() != human_genotypes)
+   {
+      throw std::runtime_error(human_file + " contains bacterial, not human, genotypes");
+   }
+   else if (human_in.samples() != _num_samples)
+   {
+      throw std::runtime_error("human snps: sample size incorrect in " + human_file);
+   }
+
+   long int line_nr = 1;
+   if (chunk_start > 0)
+   {
+      line_nr = std::min(chunk_start, (long int)human_in.variants() + 1);
+   }
+
+   for (; line_nr <= (long int)human_in.variants(); ++line_nr)
+   {
+      size_t variant = line_nr - 1;
+      if (!push_variant(std::make_shared<const HumanVariant>(human_in.plane(variant, 0), human_in.plane(variant, 1), human_in.plane(variant, 2), _num_samples, line_nr)))
+      {
+         break;
+      }
+
+      if (chunk_end > 0 && line_nr >= chunk_end)
+      {
+         line_nr--;
+         break;
+      }
+   }
+
+   return line_nr;
+}
+
+// PLINK .bed input. Lines are the variant's line in the .bim. Returns the
+// final line number
+long int HumanReader::read_bed(const BedFile& human_in, const long int chunk_start, const long int chunk_end)
+{
+   if (human_in.samples() != _num_samples)
+   {
+      throw std::runtime_error("human snps: sample size incorrect in .bed");
+   }
+
+   long int line_nr = 1;
+   if (chunk_start > 0)
+   {
+      line_nr = std::min(chunk_start, (long int)human_in.variants() + 1);
+   }
+
+   bitPlane het, hom, missing;
+   for (; line_nr <= (long int)human_in.variants(); ++line_nr)
+   {
+      human_in.planes(line_nr - 1, het, hom, missing);
+      if (!push_variant(std::make_shared<const HumanVariant>(het.data(), hom.data(), missing.data(), _num_samples, line_nr)))
+      {
+         break;
+      }
+
+      if (chunk_end > 0 && line_nr >= chunk_end)
+      {
+         line_nr--;
+         break;
+      }
+   }
+
+   return line_nr;
+}
@@ -0,0 +1,68 @@
+/*
+ * humanReader.hpp
+ * Header file for HumanReader class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <exception>
+
+class HumanVariant;
+class BedFile;
+
+// Reads and decodes the human file on its own thread, ahead of the tests.
+// Decoded variants wait in a bounded ring buffer. The reader blocks when
+// this is full, and next() waits when it is empty
+class HumanReader
+{
+   public:
+      // Initialisation. Starts reading straight away. chunk_start and
+      // chunk_end are 1-indexed and inclusive, with 0 for no limit. A PLINK
+      // .bed which has already been opened is read from bed_file
+      HumanReader(const std::string& human_file, const size_t num_samples, const long int chunk_start, const long int chunk_end, const size_t capacity, const std::shared_ptr<const BedFile>& bed_file = nullptr); // this is defined in humanReader.cpp
+      ~HumanReader();
+
+      HumanReader(const HumanReader&) = delete;
+      HumanReader& operator=(const HumanReader&) = delete;
+
+      // Next variant in file order. Returns false once the file (or chunk)
+      // is finished. Errors from the reading thread are rethrown here
+      bool next(std::shared_ptr<const HumanVariant>& human);
+
+      // nonmodifying operations
+      long int line_nr() const { return _line_nr; } // only valid once next() has returned false
+      size_t starved() const { return _starved; }
+      size_t blocked() const { return _blocked; }
+
+   private:
+      void read_variants(const std::string human_file, const std::shared_ptr<const BedFile> bed_file, const long int chunk_start, const long int chunk_end);
+      long int read_csv(const std::string& human_file, const long int chunk_start, const long int chunk_end);
+      long int read_binary(const std::string& human_file, const long int chunk_start, const long int chunk_end);
+      long int read_bed(const BedFile& human_in, const long int chunk_start, const long int chunk_end);
+      bool push_variant(const std::shared_ptr<const HumanVariant>& human);
+
+      size_t _num_samples;
+
+      std::vector<std::shared_ptr<const HumanVariant>> _ring;
+      size_t _head;
+      size_t _count;
+      bool _finished;
+      bool _stop;
+      std::exception_ptr _error;
+
+      long int _line_nr;
+      size_t _starved;
+      size_t _blocked;
+
+      std::mutex _mutex;
+      std::condition_variable _not_empty;
+      std::condition_variable _not_full;
+      std::thread _reader;
+};
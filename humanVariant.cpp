@@ -0,0 +1,68 @@
+/*
+ * File: humanVariant.cpp
+ *
+ * Decoding of human genotypes
+ *
+ */
+
+#include "humanVariant.hpp"
+
+// Set the genotypes and maf from decoded genotypes
+HumanVariant::HumanVariant(const std::vector<uint8_t>& genotypes, const long int human_line)
+   :_human_line(human_line), _het(planeWords(genotypes.size()), 0), _hom(planeWords(genotypes.size()), 0), _missing_mask(planeWords(genotypes.size()), 0), _het_count(0), _hom_count(0), _maf(0), _missing(0)
+{
+   _x.zeros(genotypes.size());
+
+   for (size_t i = 0; i < genotypes.size(); ++i)
+   {
+      switch (genotypes[i])
+      {
+         case 1:
+            _x[i] = 1;
+            setPlaneBit(_het, i);
+            break;
+         case 2:
+            _x[i] = 2;
+            setPlaneBit(_hom, i);
+            break;
+         // missing as ref
+         case genotype_missing:
+            setPlaneBit(_missing_mask, i);
+            break;
+      }
+   }
+
+   _het_count = popcountPlane(_het);
+   _hom_count = popcountPlane(_hom);
+   if (_x.n_elem > 0)
+   {
+      _maf = (double)(_het_count + 2*_hom_count)/_x.n_elem;
+      _missing = (double)popcountPlane(_missing_mask)/_x.n_elem;
+   }
+}
+
+// Set the genotypes and maf from already packed planes
+HumanVariant::HumanVariant(const uint64_t* het, const uint64_t* hom, const uint64_t* missing, const size_t num_samples, const long int human_line)
+   :_human_line(human_line), _het(het, het + planeWords(num_samples)), _hom(hom, hom + planeWords(num_samples)), _missing_mask(missing, missing + planeWords(num_samples)), _het_count(0), _hom_count(0), _maf(0), _missing(0)
+{
+   _x.zeros(num_samples);
+   for (size_t i = 0; i < num_samples; ++i)
+   {
+      if (planeBit(_het, i))
+      {
+         _x[i] = 1;
+      }
+      else if (planeBit(_hom, i))
+      {
+         _x[i] = 2;
+      }
+   }
+
+   _het_count = popcountPlane(_het);
+   _hom_count = popcountPlane(_hom);
+   if (_x.n_elem > 0)
+   {
+      _maf = (double)(_het_count + 2*_hom_count)/_x.n_elem;
+      _missing = (double)popcountPlane(_missing_mask)/_x.n_elem;
+   }
+}
@@ -0,0 +1,62 @@
+/*
+ * humanVariant.hpp
+ * Header file for HumanVariant class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <exception>
+
+// Armadillo/dlib headers
+#include "armadilloConfig.hpp"
+
+// Packed planes
+#include "genotypeKernels.hpp"
+
+// A decoded human variant. This is read-only once constructed, so a single
+// copy can be shared between all the pairs it is tested in
+class HumanVariant
+{
+   public:
+      // Initialisation
+      HumanVariant(const std::vector<uint8_t>& genotypes, const long int human_line); // this is defined in humanVariant.cpp
+      HumanVariant(const uint64_t* het, const uint64_t* hom, const uint64_t* missing, const size_t num_samples, const long int human_line); // this is defined in humanVariant.cpp
+
+      // nonmodifying operations
+      long int line() const { return _human_line; }
+      double maf() const { return _maf; }
+      double missing() const { return _missing; }
+      size_t size() const { return _x.n_elem; }
+
+      const arma::vec& genotypes() const { return _x; }
+
+      // Genotype 0/1/2 is stored as two bit planes, one for each non-reference
+      // genotype. Missing samples are only set in the missing plane
+      const bitPlane& het_plane() const { return _het; }
+      const bitPlane& hom_plane() const { return _hom; }
+      const bitPlane& missing_plane() const { return _missing_mask; }
+      size_t het_count() const { return _het_count; }
+      size_t hom_count() const { return _hom_count; }
+
+      // Variants with the same pattern give the same result in every test.
+      // Missing samples are counted as 0, so are not part of the pattern
+      uint64_t pattern_hash() const { return hashPlane(_hom, hashPlane(_het)); }
+      bool same_pattern(const HumanVariant& other) const { return _het == other._het && _hom == other._hom; }
+
+   private:
+      long int _human_line;
+
+      arma::vec _x;
+      bitPlane _het;
+      bitPlane _hom;
+      bitPlane _missing_mask;
+      size_t _het_count;
+      size_t _hom_count;
+
+      double _maf;
+      double _missing;
+};
@@ -0,0 +1,531 @@
+/*
+ * File: lineReader.cpp
+ *
+ * Line by line reading of gzipped or plain text, with an index so a chunk
+ * can start at any line without decompressing the lines before it.
+ * Access points follow zlib's examples/zran.c
+ *
+ */
+
+#include "lineReader.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const size_t index_window_size = 32768;       // deflate history size
+const uint64_t index_span = 16 * 1048576;     // uncompressed bytes between access points
+const size_t reader_chunk_size = 262144;
+const char line_index_magic[8] = {'E', 'P', 'I', 'L', 'I', 'D', 'X', '1'};
+
+// Whether a file starts with the gzip magic number
+static bool isGzipped(FILE* file)
+{
+   unsigned char magic[2] = {0, 0};
+   size_t read = fread(magic, 1, 2, file);
+   rewind(file);
+   return read == 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+std::string lineIndexFile(const std::string& filename)
+{
+   return filename + ".epi_idx";
+}
+
+LineReader::LineReader(const std::string& filename)
+   :_filename(filename), _file(nullptr), _gzip(false), _raw(false), _in_member(false), _skip_trailer(0), _in(reader_chunk_size), _out(reader_chunk_size), _out_pos(0), _out_len(0)
+{
+   _file = fopen(filename.c_str(), "rb");
+   if (_file == nullptr)
+   {
+      throw std::runtime_error("Could not open " + filename);
+   }
+   _gzip = isGzipped(_file);
+
+   memset(&_strm, 0, sizeof(_strm));
+   if (_gzip && inflateInit2(&_strm, 47) != Z_OK) // 47: gzip, largest window
+   {
+      fclose(_file);
+      throw std::runtime_error("Could not start decompression of " + filename);
+   }
+}
+
+LineReader::~LineReader()
+{
+   if (_gzip)
+   {
+      inflateEnd(&_strm);
+   }
+   fclose(_file);
+}
+
+bool LineReader::getline(std::string& line)
+{
+   line.clear();
+   bool found_any = false;
+   while (true)
+   {
+      if (_out_pos == _out_len && !refill())
+      {
+         return found_any;
+      }
+      found_any = true;
+
+      const unsigned char* start = _out.data() + _out_pos;
+      const unsigned char* newline = static_cast<const unsigned char*>(memchr(start, '\n', _out_len - _out_pos));
+      if (newline != nullptr)
+      {
+         line.append(reinterpret_cast<const char*>(start), newline - start);
+         _out_pos += newline - start + 1;
+         return true;
+      }
+
+      line.append(reinterpret_cast<const char*>(start), _out_len - _out_pos);
+      _out_pos = _out_len;
+   }
+}
+
+// Decompresses (or reads) the next chunk of the file. Returns false at end
+// of file
+bool LineReader::refill()
+{
+   _out_pos = 0;
+   _out_len = 0;
+
+   if (!_gzip)
+   {
+      _out_len = fread(_out.data(), 1, _out.size(), _file);
+      return _out_len > 0;
+   }
+
+   _strm.next_out = _out.data();
+   _strm.avail_out = _out.size();
+   while (_strm.avail_out == _out.size())
+   {
+      if (_strm.avail_in == 0)
+      {
+         _strm.avail_in = fread(_in.data(), 1, _in.size(), _file);
+         _strm.next_in = _in.data();
+         if (_strm.avail_in == 0)
+         {
+            if (ferror(_file) || _in_member)
+            {
+               throw std::runtime_error(_filename + " is truncated or could not be read");
+            }
+            break;
+         }
+      }
+
+      // After a seek decompression is of raw deflate data, so the member
+      // trailer is skipped by hand before going back to gzip mode
+      if (_skip_trailer > 0)
+      {
+         size_t skip = std::min((size_t)_strm.avail_in, _skip_trailer);
+         _strm.next_in += skip;
+         _strm.avail_in -= skip;
+         _skip_trailer -= skip;
+         if (_skip_trailer == 0)
+         {
+            inflateReset2(&_strm, 47);
+         }
+         continue;
+      }
+
+      _in_member = true;
+      int ret = inflate(&_strm, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+      {
+         // Files may be several concatenated gzip members
+         _in_member = false;
+         if (_raw)
+         {
+            _raw = false;
+            _skip_trailer = 8;
+         }
+         else
+         {
+            inflateReset(&_strm);
+         }
+      }
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      {
+         throw std::runtime_error("Decompression error in " + _filename + ": " + (_strm.msg ? _strm.msg : "unknown"));
+      }
+   }
+
+   _out_len = _out.size() - _strm.avail_out;
+   return _out_len > 0;
+}
+
+// Back to the start of the file
+void LineReader::restart()
+{
+   rewind(_file);
+   _out_pos = 0;
+   _out_len = 0;
+   _skip_trailer = 0;
+   _in_member = false;
+   _raw = false;
+   if (_gzip)
+   {
+      _strm.avail_in = 0;
+      inflateReset2(&_strm, 47);
+   }
+}
+
+// Restarts decompression from an access point
+void LineReader::restore(const accessPoint& point)
+{
+   if (point.out_offset == 0)
+   {
+      restart();
+      return;
+   }
+
+   _out_pos = 0;
+   _out_len = 0;
+   _skip_trailer = 0;
+   if (!_gzip)
+   {
+      fseeko(_file, point.in_offset, SEEK_SET);
+      return;
+   }
+
+   // Points are at deflate block boundaries, which may be part way through
+   // a byte
+   fseeko(_file, point.in_offset - (point.bits ? 1 : 0), SEEK_SET);
+   _strm.avail_in = 0;
+   inflateReset2(&_strm, -15);
+   _raw = true;
+   _in_member = true;
+   if (point.bits)
+   {
+      int byte = fgetc(_file);
+      if (byte == EOF)
+      {
+         throw std::runtime_error(_filename + " has changed since it was indexed");
+      }
+      inflatePrime(&_strm, point.bits, byte >> (8 - point.bits));
+   }
+   inflateSetDictionary(&_strm, point.window.data(), point.window.size());
+}
+
+void LineReader::seek_line(const long int line_nr)
+{
+   if (_index.empty())
+   {
+      load_index();
+   }
+
+   // Last access point before the line
+   const accessPoint* point = &_index.front();
+   for (auto it = _index.begin(); it != _index.end(); ++it)
+   {
+      if (it->first_line > 0 && (long int)it->first_line <= line_nr)
+      {
+         point = &(*it);
+      }
+   }
+   restore(*point);
+
+   // Discard output up to the first line start, then whole lines
+   uint64_t skip = point->line_offset - point->out_offset;
+   while (skip > 0)
+   {
+      if (_out_pos == _out_len && !refill())
+      {
+         return;
+      }
+      size_t available = std::min((uint64_t)(_out_len - _out_pos), skip);
+      _out_pos += available;
+      skip -= available;
+   }
+
+   std::string discard;
+   for (long int line = point->first_line; line < line_nr; ++line)
+   {
+      if (!getline(discard))
+      {
+         break;
+      }
+   }
+}
+
+// Reads the index if it is up to date, otherwise builds and saves it
+void LineReader::load_index()
+{
+   struct stat file_stat;
+   if (stat(_filename.c_str(), &file_stat) != 0)
+   {
+      throw std::runtime_error("Can't stat input file: " + _filename);
+   }
+   uint64_t file_size = file_stat.st_size;
+   int64_t file_mtime = file_stat.st_mtime;
+
+   std::string index_file = lineIndexFile(_filename);
+   std::ifstream index_in(index_file.c_str(), std::ios::binary);
+   if (index_in)
+   {
+      char magic[sizeof(line_index_magic)];
+      uint64_t indexed_size = 0, num_points = 0;
+      int64_t indexed_mtime = 0;
+      index_in.read(magic, sizeof(magic));
+      index_in.read(reinterpret_cast<char*>(&indexed_size), sizeof(indexed_size));
+      index_in.read(reinterpret_cast<char*>(&indexed_mtime), sizeof(indexed_mtime));
+      index_in.read(reinterpret_cast<char*>(&num_points), sizeof(num_points));
+
+      if (index_in && memcmp(magic, line_index_magic, sizeof(magic)) == 0 && indexed_size == file_size && indexed_mtime == file_mtime)
+      {
+         _index.resize(num_points);
+         for (auto it = _index.begin(); it != _index.end() && index_in; ++it)
+         {
+            uint32_t window_size = 0;
+            index_in.read(reinterpret_cast<char*>(&it->first_line), sizeof(it->first_line));
+            index_in.read(reinterpret_cast<char*>(&it->line_offset), sizeof(it->line_offset));
+            index_in.read(reinterpret_cast<char*>(&it->out_offset), sizeof(it->out_offset));
+            index_in.read(reinterpret_cast<char*>(&it->in_offset), sizeof(it->in_offset));
+            index_in.read(reinterpret_cast<char*>(&it->bits), sizeof(it->bits));
+            index_in.read(reinterpret_cast<char*>(&window_size), sizeof(window_size));
+            it->window.resize(window_size);
+            index_in.read(reinterpret_cast<char*>(it->window.data()), window_size);
+         }
+
+         if (index_in && !_index.empty())
+         {
+            return;
+         }
+      }
+      std::cerr << "Line index " << index_file << " is out of date, rebuilding it" << std::endl;
+   }
+   index_in.close();
+
+   std::cerr << "Building line index for " << _filename << std::endl;
+   _index = buildLineIndex(_filename);
+
+   // Written to a temporary name first, so concurrent jobs never see half
+   // an index
+   std::string temp_file = index_file + "." + std::to_string(getpid());
+   std::ofstream index_out(temp_file.c_str(), std::ios::binary | std::ios::trunc);
+   uint64_t num_points = _index.size();
+   index_out.write(line_index_magic, sizeof(line_index_magic));
+   index_out.write(reinterpret_cast<const char*>(&file_size), sizeof(file_size));
+   index_out.write(reinterpret_cast<const char*>(&file_mtime), sizeof(file_mtime));
+   index_out.write(reinterpret_cast<const char*>(&num_points), sizeof(num_points));
+   for (auto it = _index.begin(); it != _index.end(); ++it)
+   {
+      uint32_t window_size = it->window.size();
+      index_out.write(reinterpret_cast<const char*>(&it->first_line), sizeof(it->first_line));
+      index_out.write(reinterpret_cast<const char*>(&it->line_offset), sizeof(it->line_offset));
+      index_out.write(reinterpret_cast<const char*>(&it->out_offset), sizeof(it->out_offset));
+      index_out.write(reinterpret_cast<const char*>(&it->in_offset), sizeof(it->in_offset));
+      index_out.write(reinterpret_cast<const char*>(&it->bits), sizeof(it->bits));
+      index_out.write(reinterpret_cast<const char*>(&window_size), sizeof(window_size));
+      index_out.write(reinterpret_cast<const char*>(it->window.data()), window_size);
+   }
+   index_out.close();
+
+   if (!index_out || rename(temp_file.c_str(), index_file.c_str()) != 0)
+   {
+      std::cerr << "WARNING: Could not save line index to " << index_file << ", it will be rebuilt next time" << std::endl;
+      remove(temp_file.c_str());
+   }
+}
+
+// Keeps track of which line starts first after each access point
+class lineTracker
+{
+   public:
+      lineTracker()
+         :_line_nr(1), _line_start(0)
+      {
+      }
+
+      // Register a new access point, at the current end of output
+      void add_point(std::vector<accessPoint>& index, accessPoint& point)
+      {
+         if (point.out_offset == _line_start)
+         {
+            point.first_line = _line_nr;
+            point.line_offset = _line_start;
+         }
+         else
+         {
+            _pending.push_back(index.size());
+         }
+         index.push_back(point);
+      }
+
+      // Scan newly produced output, starting at offset
+      void scan(std::vector<accessPoint>& index, const unsigned char* data, const size_t length, const uint64_t offset)
+      {
+         const unsigned char* pos = data;
+         const unsigned char* end = data + length;
+         while ((pos = static_cast<const unsigned char*>(memchr(pos, '\n', end - pos))) != nullptr)
+         {
+            pos++;
+            _line_nr++;
+            _line_start = offset + (pos - data);
+
+            for (auto it = _pending.begin(); it != _pending.end(); ++it)
+            {
+               index[*it].first_line = _line_nr;
+               index[*it].line_offset = _line_start;
+            }
+            _pending.clear();
+         }
+      }
+
+   private:
+      uint64_t _line_nr;
+      uint64_t _line_start;
+      std::vector<size_t> _pending;
+};
+
+// Makes a full pass through the file, recording an access point at a
+// deflate block boundary every index_span bytes of output
+std::vector<accessPoint> buildLineIndex(const std::string& filename)
+{
+   FILE* file = fopen(filename.c_str(), "rb");
+   if (file == nullptr)
+   {
+      throw std::runtime_error("Could not open " + filename);
+   }
+
+   std::vector<accessPoint> index;
+   lineTracker lines;
+
+   accessPoint start;
+   start.first_line = 0;
+   start.line_offset = 0;
+   start.out_offset = 0;
+   start.in_offset = 0;
+   start.bits = 0;
+   lines.add_point(index, start);
+
+   std::vector<unsigned char> input(reader_chunk_size);
+   if (!isGzipped(file))
+   {
+      // Plain text can be seeked to directly, so only line positions are
+      // needed
+      uint64_t total = 0, last = 0;
+      size_t read;
+      while ((read = fread(input.data(), 1, input.size(), file)) > 0)
+      {
+         lines.scan(index, input.data(), read, total);
+         total += read;
+         if (total - last > index_span)
+         {
+            accessPoint point;
+            point.first_line = 0;
+            point.line_offset = 0;
+            point.out_offset = total;
+            point.in_offset = total;
+            point.bits = 0;
+            lines.add_point(index, point);
+            last = total;
+         }
+      }
+      fclose(file);
+      return index;
+   }
+
+   z_stream strm;
+   memset(&strm, 0, sizeof(strm));
+   if (inflateInit2(&strm, 47) != Z_OK)
+   {
+      fclose(file);
+      throw std::runtime_error("Could not start decompression of " + filename);
+   }
+
+   std::vector<unsigned char> window(index_window_size);
+   uint64_t total_in = 0, total_out = 0, last = 0;
+   int ret = Z_OK;
+   bool in_member = false;
+   strm.avail_out = 0;
+   try
+   {
+      while (true)
+      {
+         strm.avail_in = fread(input.data(), 1, input.size(), file);
+         strm.next_in = input.data();
+         if (strm.avail_in == 0)
+         {
+            if (ferror(file) || in_member)
+            {
+               throw std::runtime_error(filename + " is truncated or could not be read");
+            }
+            break;
+         }
+
+         while (strm.avail_in != 0)
+         {
+            if (strm.avail_out == 0)
+            {
+               strm.avail_out = window.size();
+               strm.next_out = window.data();
+            }
+
+            // Stop at the end of each deflate block
+            unsigned char* out_start = strm.next_out;
+            total_in += strm.avail_in;
+            total_out += strm.avail_out;
+            in_member = true;
+            ret = inflate(&strm, Z_BLOCK);
+            total_in -= strm.avail_in;
+            total_out -= strm.avail_out;
+
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR || ret == Z_STREAM_ERROR)
+            {
+               throw std::runtime_error("Decompression error in " + filename + ": " + (strm.msg ? strm.msg : "unknown"));
+            }
+
+            size_t produced = strm.next_out - out_start;
+            lines.scan(index, out_start, produced, total_out - produced);
+
+            if (ret == Z_STREAM_END)
+            {
+               in_member = false;
+               inflateReset(&strm);
+               continue;
+            }
+
+            // At a block boundary which is not the last block
+            if ((strm.data_type & 128) && !(strm.data_type & 64) && total_out - last > index_span)
+            {
+               accessPoint point;
+               point.first_line = 0;
+               point.line_offset = 0;
+               point.out_offset = total_out;
+               point.in_offset = total_in;
+               point.bits = strm.data_type & 7;
+
+               // Window is circular. Oldest output starts where the next
+               // write will go
+               size_t left = strm.avail_out;
+               point.window.resize(index_window_size);
+               memcpy(point.window.data(), window.data() + window.size() - left, left);
+               memcpy(point.window.data() + left, window.data(), window.size() - left);
+
+               lines.add_point(index, point);
+               last = total_out;
+            }
+         }
+      }
+   }
+   catch (...)
+   {
+      inflateEnd(&strm);
+      fclose(file);
+      throw;
+   }
+
+   inflateEnd(&strm);
+   fclose(file);
+
+   // The start of the file is always line 1
+   index.front().first_line = 1;
+   return index;
+}
@@ -0,0 +1,76 @@
+/*
+ * lineReader.hpp
+ * Header file for LineReader class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <exception>
+#include <stdexcept>
+
+// zlib headers
+#include <zlib.h>
+
+// Somewhere decompression can be restarted from, and the first line which
+// starts after it
+struct accessPoint
+{
+   uint64_t first_line;
+   uint64_t line_offset;
+   uint64_t out_offset;
+   uint64_t in_offset;
+   int32_t bits;
+   std::vector<unsigned char> window;
+};
+
+// Reads lines from a gzipped or plain text file. Can jump to any line using
+// an index of access points, which is built on first use and stored next to
+// the file (as file.epi_idx)
+class LineReader
+{
+   public:
+      // Initialisation
+      LineReader(const std::string& filename); // this is defined in lineReader.cpp
+      ~LineReader();
+
+      LineReader(const LineReader&) = delete;
+      LineReader& operator=(const LineReader&) = delete;
+
+      // Reads the next line, without its newline. Returns false at end of
+      // file
+      bool getline(std::string& line);
+
+      // Makes the next line read line_nr (1-indexed)
+      void seek_line(const long int line_nr);
+
+   private:
+      bool refill();
+      void restart();
+      void restore(const accessPoint& point);
+      void load_index();
+
+      std::string _filename;
+      FILE* _file;
+      bool _gzip;
+
+      z_stream _strm;
+      bool _raw;
+      bool _in_member;
+      size_t _skip_trailer;
+
+      std::vector<unsigned char> _in;
+      std::vector<unsigned char> _out;
+      size_t _out_pos;
+      size_t _out_len;
+
+      std::vector<accessPoint> _index;
+};
+
+// lineReader.cpp
+std::string lineIndexFile(const std::string& filename);
+std::vector<accessPoint> buildLineIndex(const std::string& filename);
@@ -10,7 +10,7 @@ class LinkFunction
    public:
       // Initialisation
       LinkFunction(const arma::mat& _predictors, const arma::vec& _responses, const double _lambda = 0)
-         : predictors(_predictors), responses(_responses), lambda(_lambda)
+         : predictors(_predictors), responses(_responses), work(threadWorkspace().sample_work), lambda(_lambda)
       {
       }
 
@@ -21,31 +21,56 @@ class LinkFunction
          const;
 
    protected:
-      arma::mat predictors;
-      arma::vec responses;
+      // Not copied; must outlive the function object
+      const arma::mat& predictors;
+      const arma::vec& responses;
+
+      // Borrowed from the workspace of the thread which made this, so
+      // evaluations do not allocate. Only use on that thread
+      arma::vec& work;
 
       double lambda;
 };
 
+// The likelihood and its gradient come from a single evaluation, which is
+// kept so that asking for both at the same parameters costs one pass
 class LogitLikelihood : public LinkFunction
 {
    public:
       LogitLikelihood(const arma::mat& _predictors, const arma::vec& _responses, const double _lambda = 0)
-         : LinkFunction(_predictors, _responses, _lambda)
+         : LinkFunction(_predictors, _responses, _lambda), cached(false)
       {
       }
 
       double operator() (const column_vector& parameters_in) const;
+      double operator() (const arma::vec& parameters) const;
+      column_vector gradient(const column_vector& parameters_in) const;
+
+   private:
+      void evaluate(const arma::vec& parameters) const;
+
+      // Last evaluation
+      mutable bool cached;
+      mutable arma::vec cached_parameters;
+      mutable double cached_value;
+      mutable arma::vec cached_gradient;
 };
 
-class LogitLikelihoodGradient : public LinkFunction
+// Gradient functor for dlib, sharing the evaluations of a likelihood
+class LogitLikelihoodGradient
 {
    public:
-      LogitLikelihoodGradient(const arma::mat& _predictors, const arma::vec& _responses, const double _lambda = 0)
-         : LinkFunction(_predictors, _responses, _lambda)
+      LogitLikelihoodGradient(const LogitLikelihood& _likelihood)
+         : likelihood(_likelihood)
+      {
+      }
+
+      column_vector operator() (const column_vector& parameters_in) const
       {
+         return likelihood.gradient(parameters_in);
       }
 
-      column_vector operator() (const column_vector& parameters_in) const;
+   private:
+      const LogitLikelihood& likelihood;
 };
 
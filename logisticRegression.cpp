@@ -7,16 +7,44 @@
 
 #include "linkFunction.hpp" // includes epistasis.hpp
 
+// The workspace of the calling thread. Fits borrow buffers from it rather
+// than allocating their own
+fitWorkspace& threadWorkspace()
+{
+   static thread_local fitWorkspace workspace;
+   return workspace;
+}
+
+// Write the design matrix [1 | x | covars] into x_design. Its memory is only
+// reallocated if the number of columns changes, so one buffer can be reused
+// for every pair. x has no columns for the null model
+void designMatrix(const arma::mat& x, const BacterialVariant& bact, arma::mat& x_design)
+{
+   size_t num_covars = bact.covars_set() ? bact.get_covars().n_cols : 0;
+
+   x_design.set_size(bact.size(), 1 + x.n_cols + num_covars);
+   x_design.col(0).ones();
+   if (x.n_cols > 0)
+   {
+      x_design.cols(1, x.n_cols) = x;
+   }
+   if (num_covars > 0)
+   {
+      x_design.cols(1 + x.n_cols, x_design.n_cols - 1) = bact.get_covars();
+   }
+}
+
 // This uses BFGS optimisation by default. Invokes NR or Firth on error
-void doLogit(Pair& p)
+// The fitted parameters are written to coefficients, which is left empty if
+// the fit fails
+void doLogit(PairResult& p, const arma::vec& y_train, const arma::mat& x_design, arma::vec& coefficients)
 {
-   arma::mat x_design = p.get_x_design();
-   arma::vec y_train = p.get_y();
+   coefficients.reset();
    column_vector starting_point(x_design.n_cols);
 
-   if (p.firth())
+   if (p.firth)
    {
-      newtonRaphson(p, y_train, x_design, 1);
+      newtonRaphson(p, y_train, x_design, 1, coefficients);
    }
    else
    {
@@ -34,14 +62,15 @@ void doLogit(Pair& p)
 
          dlib::find_max(dlib::bfgs_search_strategy(),
                      dlib::objective_delta_stop_strategy(convergence_limit),
-                     likelihood_fit, LogitLikelihoodGradient(x_design, y_train),
+                     likelihood_fit, LogitLikelihoodGradient(likelihood_fit),
                      starting_point, -1);
 
          // Extract beta and likelihood
          arma::vec b_vector = dlib_to_arma(starting_point);
-         p.beta(b_vector(1));
+         p.beta = b_vector(1);
 
-         p.log_likelihood(likelihood_fit(starting_point));
+         p.log_likelihood = likelihood_fit(starting_point);
+         coefficients = b_vector;
 
          // Extract p-value
          //
@@ -61,14 +90,14 @@ void doLogit(Pair& p)
          }
          else
          {
-            p.standard_error(se);
+            p.se = se;
 
             double W = std::abs(b_vector(1)) / se; // null hypothesis b_1 = 0
-            p.p_val(normalPval(W));
+            p.lrt_p = normalPval(W);
 
 #ifdef SEER_DEBUG
             std::cerr << "Wald statistic: " << W << "\n";
-            std::cerr << "p-value: " << p.p_val() << "\n";
+            std::cerr << "p-value: " << p.lrt_p << "\n";
 #endif
          }
       }
@@ -82,144 +111,385 @@ void doLogit(Pair& p)
          // SE is greater than specified limit - run Firth regression
          if (strcmp(e.what(), "se>limit") == 0)
          {
-            p.add_comment("large-se");
-            newtonRaphson(p, y_train, x_design, 1);
+            p.flags |= flag_large_se;
+            newtonRaphson(p, y_train, x_design, 1, coefficients);
          }
          // BFGS optimiser did not converge - use NR iterations w/o Firth first
          // Could also be matrix inversion failing
          else
          {
-            p.add_comment("bfgs-fail");
-            newtonRaphson(p, y_train, x_design, 0);
+            p.flags |= flag_bfgs_fail;
+            newtonRaphson(p, y_train, x_design, 0, coefficients);
          }
       }
    }
 }
 
-void newtonRaphson(Pair& p, const arma::vec& y_train, const arma::mat& x_design, const bool firth)
+void newtonRaphson(PairResult& p, const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& coefficients)
 {
-   // Keep iterations to track convergence
-   // Also useful to keep second derivative, for calculating p-value
-   std::vector<arma::vec> parameter_iterations;
-   arma::mat var_covar_mat;
-   int failed = 0;
-
    // Could get starting point from a linear regression, which is fast
    // and will reduce number of n-r iterations
    // Set up design matrix, and calculate (X'X)^-1
    // Seems more reliable to go for b = 0, plus a non-zero intercept
    // See: doi:10.1016/S0169-2607(02)00088-3
-   arma::vec starting_point = arma::zeros(x_design.n_cols);
-   starting_point(0) = log(mean(y_train)/(1 - mean(y_train)));
+   arma::vec b = arma::zeros(x_design.n_cols);
+   b(0) = log(mean(y_train)/(1 - mean(y_train)));
 
-   parameter_iterations.push_back(starting_point);
+   // Second derivative is kept for calculating the p-value
+   arma::mat var_covar_mat;
+   unsigned int iterations = 0;
+   irlsStatus status = irls(y_train, x_design, firth, b, var_covar_mat, iterations);
+   countNewtonIterations(std::min(iterations, max_nr_iterations));
 
-   for (unsigned int i = 0; i < max_nr_iterations; ++i)
+#ifdef SEER_DEBUG
+   std::cerr << "Number of iterations: " << iterations << "\n";
+#endif
+   if (status == irls_inv_fail)
+   {
+      p.flags |= flag_inv_fail;
+      p.lrt_p = 0;
+      std::cerr << "Inversion at input line " << p.bact_line << "," << p.human_line << " failed" << std::endl;
+   }
+   // If convergence not reached, try Firth logistic regression
+   else if (status == irls_not_converged)
    {
-      arma::vec b0 = parameter_iterations.back();
-      arma::vec y_pred = predictLogitProbs(x_design, b0);
+      if (!firth)
+      {
+         p.flags |= flag_nr_fail;
+         newtonRaphson(p, y_train, x_design, 1, coefficients);
+      }
+      else
+      {
+         p.flags |= flag_firth_fail;
+      }
+   }
+   else
+   {
+      // Add beta and log-likelihood
+      LogitLikelihood likelihood_fit(x_design, y_train);
+      if (p.firth)
+      {
+         p.log_likelihood = likelihood_fit(b) + 0.5*log(det(inv_covar(var_covar_mat)));
+      }
+      else
+      {
+         p.log_likelihood = likelihood_fit(b);
+      }
+
+      p.beta = b(1);
+      coefficients = b;
 
-      arma::mat U(x_design.n_cols, 1);
-      arma::mat W = repmat(y_pred % (arma::ones(y_pred.n_rows) - y_pred), 1, x_design.n_cols);
+      double se = pow(var_covar_mat(1,1), 0.5);
+      p.se = se;
+
+      // Deal with large SEs
+      if (se > se_limit)
+      {
+         if (!firth)
+         {
+            newtonRaphson(p, y_train, x_design, 1, coefficients);
+         }
+         else
+         {
+            p.flags |= flag_large_se;
+         }
+      }
+
+      double W = std::abs(p.beta) / se;
+      p.lrt_p = normalPval(W);
+
+#ifdef SEER_DEBUG
+      std::cerr << "Wald statistic: " << W << "\n";
+      std::cerr << "p-value: " << p.lrt_p << "\n";
+#endif
+   }
+}
+
+// Newton-Raphson (IRLS) iterations from b, for any number of coefficients.
+// var_covar_mat is from the last iteration
+static irlsStatus dynamicIrls(const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& b, arma::mat& var_covar_mat, unsigned int& iterations)
+{
+   for (iterations = 1; iterations <= max_nr_iterations; ++iterations)
+   {
+      arma::vec y_pred = predictLogitProbs(x_design, b);
+
+      arma::vec U;
+      arma::vec w = y_pred % (1 - y_pred);
 
       // Perform inversion, which may fail
-      var_covar_mat = inv_covar(x_design.t() * (W % x_design));
+      var_covar_mat = inv_covar(x_design.t() * (x_design.each_col() % w));
       if (var_covar_mat.n_cols == 0 || var_covar_mat.n_rows == 0)
       {
-         p.add_comment("inv-fail");
-         p.p_val(0);
-         std::cerr << "Inversion at input line " << p.bact_line() << "," << p.human_line() << " failed" << std::endl;
-         failed = 1;
-         break;
+         return irls_inv_fail;
       }
 
       if (firth)
       {
          // Firth logistic regression
          // See: DOI: 10.1002/sim.1047
-         // Hat matrix
-         // Note: W is diagonal so X.t() * W * X is still sympd
-         arma::mat H = (sqrt(W) % x_design) * var_covar_mat * (x_design.t() % sqrt(W).t());
-
-         arma::vec correction(y_train.n_rows);
-         correction.fill(0.5);
+         // Only the diagonal of the hat matrix W^1/2 X (X'WX)^-1 X' W^1/2 is
+         // needed. Row i is w_i * x_i' (X'WX)^-1 x_i, which takes O(np^2)
+         // rather than forming the n x n matrix
+         arma::vec h = sum((x_design * var_covar_mat) % x_design, 1) % w;
 
          // Penalised score
-         U = x_design.t() * (y_train - y_pred + diagvec(H) % (correction - y_pred));
+         U = x_design.t() * (y_train - y_pred + h % (0.5 - y_pred));
       }
       else
       {
          U = x_design.t() * (y_train - y_pred);
       }
 
-      arma::vec b1 = b0 + var_covar_mat * U;
-      parameter_iterations.push_back(b1);
+      arma::vec b1 = b + var_covar_mat * U;
+      bool converged = std::abs(b1(1) - b(1)) < convergence_limit;
+      b = b1;
+      if (converged)
+      {
+         return irls_converged;
+      }
+   }
+
+   return irls_not_converged;
+}
+
+// Inverts a P x P symmetric positive definite matrix by Cholesky
+// decomposition A = LL', then A^-1 = L^-T L^-1. Returns false if A is not
+// positive definite
+template <arma::uword P>
+static bool fixedInvSympd(const arma::mat::fixed<P, P>& A, arma::mat::fixed<P, P>& A_inv)
+{
+   arma::mat::fixed<P, P> L(arma::fill::zeros);
+   for (arma::uword j = 0; j < P; ++j)
+   {
+      double diag = A(j,j);
+      for (arma::uword k = 0; k < j; ++k)
+      {
+         diag -= L(j,k) * L(j,k);
+      }
+      if (!(diag > 0))
+      {
+         return false;
+      }
+      L(j,j) = sqrt(diag);
 
-      if (std::abs(b1(1) - b0(1)) < convergence_limit)
+      for (arma::uword i = j + 1; i < P; ++i)
       {
-         break;
+         double sum = A(i,j);
+         for (arma::uword k = 0; k < j; ++k)
+         {
+            sum -= L(i,k) * L(j,k);
+         }
+         L(i,j) = sum / L(j,j);
       }
    }
 
-#ifdef SEER_DEBUG
-   std::cerr << "Number of iterations: " << parameter_iterations.size() - 1 << "\n";
-#endif
-   // If convergence not reached, try Firth logistic regression
-   if (parameter_iterations.size() == max_nr_iterations)
+   // L^-1 is also lower triangular
+   arma::mat::fixed<P, P> L_inv(arma::fill::zeros);
+   for (arma::uword j = 0; j < P; ++j)
    {
-      if (!firth)
+      L_inv(j,j) = 1 / L(j,j);
+      for (arma::uword i = j + 1; i < P; ++i)
       {
-         p.add_comment("nr-fail");
-         newtonRaphson(p, y_train, x_design, 1);
+         double sum = 0;
+         for (arma::uword k = j; k < i; ++k)
+         {
+            sum += L(i,k) * L_inv(k,j);
+         }
+         L_inv(i,j) = -sum / L(i,i);
       }
-      else
+   }
+
+   for (arma::uword j = 0; j < P; ++j)
+   {
+      for (arma::uword i = j; i < P; ++i)
       {
-         p.add_comment("firth-fail");
+         double sum = 0;
+         for (arma::uword k = i; k < P; ++k)
+         {
+            sum += L_inv(k,i) * L_inv(k,j);
+         }
+         A_inv(i,j) = sum;
+         A_inv(j,i) = sum;
       }
    }
-   else if (!failed)
+
+   return true;
+}
+
+// As inv_covar, using the fixed size Cholesky when it succeeds
+template <arma::uword P>
+static bool fixedInvCovar(const arma::mat::fixed<P, P>& A, arma::mat::fixed<P, P>& A_inv)
+{
+   if (fixedInvSympd<P>(A, A_inv))
    {
-      // Add beta and log-likelihood
-      column_vector converged_beta = arma_to_dlib(parameter_iterations.back());
+      return true;
+   }
 
-      LogitLikelihood likelihood_fit(x_design, y_train);
-      if (p.firth())
+   arma::mat B = inv_covar(A);
+   if (B.n_rows != P || B.n_cols != P)
+   {
+      return false;
+   }
+   A_inv = B;
+   return true;
+}
+
+// Fisher information X'WX at b in a single pass over the samples, without
+// forming W. Also sets the fitted probabilities
+template <arma::uword P>
+static void fixedInformation(const arma::mat& x_design, const arma::vec::fixed<P>& b, arma::mat::fixed<P, P>& I, arma::vec& y_pred)
+{
+   const double* cols[P];
+   for (arma::uword j = 0; j < P; ++j)
+   {
+      cols[j] = x_design.colptr(j);
+   }
+
+   I.zeros();
+   for (arma::uword i = 0; i < x_design.n_rows; ++i)
+   {
+      double x[P];
+      double eta = 0;
+      for (arma::uword j = 0; j < P; ++j)
       {
-         p.log_likelihood(likelihood_fit(converged_beta) + 0.5*log(det(inv_covar(var_covar_mat))));
+         x[j] = cols[j][i];
+         eta += x[j] * b(j);
       }
-      else
+
+      double prob = 1.0 / (1.0 + exp(-eta));
+      double w = prob * (1 - prob);
+      y_pred(i) = prob;
+
+      // Upper triangle only, as I is symmetric
+      for (arma::uword j = 0; j < P; ++j)
       {
-         p.log_likelihood(likelihood_fit(converged_beta));
+         double wx = w * x[j];
+         for (arma::uword k = j; k < P; ++k)
+         {
+            I(j,k) += wx * x[k];
+         }
       }
+   }
 
-      p.beta(converged_beta(1));
+   for (arma::uword j = 0; j < P; ++j)
+   {
+      for (arma::uword k = j + 1; k < P; ++k)
+      {
+         I(k,j) = I(j,k);
+      }
+   }
+}
 
-      double se = pow(var_covar_mat(1,1), 0.5);
-      p.standard_error(se);
+// dynamicIrls for a design matrix with P columns. The information matrix
+// and its inverse are fixed size, so live on the stack
+template <arma::uword P>
+static irlsStatus fixedIrls(const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& b, arma::mat& var_covar_mat, unsigned int& iterations)
+{
+   const arma::uword n = x_design.n_rows;
+   const double* cols[P];
+   for (arma::uword j = 0; j < P; ++j)
+   {
+      cols[j] = x_design.colptr(j);
+   }
 
-      // Deal with large SEs
-      if (se > se_limit)
+   arma::vec::fixed<P> b0 = b;
+   arma::mat::fixed<P, P> I, V;
+   arma::vec& y_pred = threadWorkspace().sample_work;
+   y_pred.set_size(n);
+   for (iterations = 1; iterations <= max_nr_iterations; ++iterations)
+   {
+      fixedInformation<P>(x_design, b0, I, y_pred);
+      if (!fixedInvCovar<P>(I, V))
       {
-         if (!firth)
+         var_covar_mat.reset();
+         return irls_inv_fail;
+      }
+
+      // Score, which with Firth regression is penalised using the leverages
+      // w_i * x_i' V x_i
+      // See: DOI: 10.1002/sim.1047
+      arma::vec::fixed<P> U(arma::fill::zeros);
+      for (arma::uword i = 0; i < n; ++i)
+      {
+         double x[P];
+         for (arma::uword j = 0; j < P; ++j)
          {
-            newtonRaphson(p, y_train, x_design, 1);
+            x[j] = cols[j][i];
          }
-         else
+
+         double residual = y_train(i) - y_pred(i);
+         if (firth)
          {
-            p.add_comment("large-se");
+            double leverage = 0;
+            for (arma::uword j = 0; j < P; ++j)
+            {
+               double Vx = 0;
+               for (arma::uword k = 0; k < P; ++k)
+               {
+                  Vx += V(j,k) * x[k];
+               }
+               leverage += x[j] * Vx;
+            }
+            leverage *= y_pred(i) * (1 - y_pred(i));
+            residual += leverage * (0.5 - y_pred(i));
+         }
+
+         for (arma::uword j = 0; j < P; ++j)
+         {
+            U(j) += residual * x[j];
          }
       }
 
-      double W = std::abs(p.beta()) / se;
-      p.p_val(normalPval(W));
+      arma::vec::fixed<P> b1 = b0 + V * U;
+      bool converged = std::abs(b1(1) - b0(1)) < convergence_limit;
+      b0 = b1;
+      if (converged)
+      {
+         break;
+      }
+   }
 
-#ifdef SEER_DEBUG
-      std::cerr << "Wald statistic: " << W << "\n";
-      std::cerr << "p-value: " << p.p_val() << "\n";
-#endif
+   b = b0;
+   var_covar_mat = V;
+   return iterations <= max_nr_iterations ? irls_converged : irls_not_converged;
+}
+
+// Runs the IRLS kernel specialised on the number of coefficients, which is
+// 2 plus the number of covariates. Larger models use the general kernel
+irlsStatus irls(const arma::vec& y_train, const arma::mat& x_design, const bool firth, arma::vec& b, arma::mat& var_covar_mat, unsigned int& iterations)
+{
+   switch (x_design.n_cols)
+   {
+      case 2: return fixedIrls<2>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 3: return fixedIrls<3>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 4: return fixedIrls<4>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 5: return fixedIrls<5>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 6: return fixedIrls<6>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 7: return fixedIrls<7>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 8: return fixedIrls<8>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 9: return fixedIrls<9>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 10: return fixedIrls<10>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 11: return fixedIrls<11>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      case 12: return fixedIrls<12>(y_train, x_design, firth, b, var_covar_mat, iterations);
+      default: return dynamicIrls(y_train, x_design, firth, b, var_covar_mat, iterations);
    }
 }
 
+// var-covar matrix at b for a design matrix with P columns
+template <arma::uword P>
+static arma::mat fixedVarCovarMat(const arma::mat& x, const arma::vec::fixed<P>& b)
+{
+   arma::mat::fixed<P, P> I, V;
+   arma::vec& y_pred = threadWorkspace().sample_work;
+   y_pred.set_size(x.n_rows);
+   fixedInformation<P>(x, b, I, y_pred);
+   if (!fixedInvCovar<P>(I, V))
+   {
+      return arma::mat();
+   }
+   return V;
+}
+
 // Returns var-covar matrix for logistic function
 arma::mat varCovarMat(const arma::mat& x, const arma::mat& b)
 {
@@ -229,6 +499,23 @@ arma::mat varCovarMat(const arma::mat& x, const arma::mat& b)
    //
    // see http://czep.net/stat/mlelr.pdf
 
+   // The information matrix is small, so use a fixed size version when
+   // there is one
+   switch (b.n_elem)
+   {
+      case 2: return fixedVarCovarMat<2>(x, b);
+      case 3: return fixedVarCovarMat<3>(x, b);
+      case 4: return fixedVarCovarMat<4>(x, b);
+      case 5: return fixedVarCovarMat<5>(x, b);
+      case 6: return fixedVarCovarMat<6>(x, b);
+      case 7: return fixedVarCovarMat<7>(x, b);
+      case 8: return fixedVarCovarMat<8>(x, b);
+      case 9: return fixedVarCovarMat<9>(x, b);
+      case 10: return fixedVarCovarMat<10>(x, b);
+      case 11: return fixedVarCovarMat<11>(x, b);
+      case 12: return fixedVarCovarMat<12>(x, b);
+   }
+
    // First get logit of x values using parameters from fit, and transform to
    // p(1-p)
    arma::vec y_pred = predictLogitProbs(x, b);
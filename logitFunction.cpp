@@ -15,8 +15,43 @@
 double LogitLikelihood::operator()(const column_vector& parameters_in)
    const
 {
-   // Convert from dlib column matrix to armadillo column matrix
-   arma::vec parameters = dlib_to_arma(parameters_in);
+   // Use the memory of the dlib vector, rather than copying it
+   const arma::vec parameters(const_cast<double*>(&parameters_in(0)), parameters_in.nr(), false, true);
+   return (*this)(parameters);
+}
+
+double LogitLikelihood::operator()(const arma::vec& parameters)
+   const
+{
+   evaluate(parameters);
+   return cached_value;
+}
+
+// Evaluate the gradient of the logistic regression objective function.
+// dlib asks for this at the point it has just evaluated the likelihood at,
+// so it is usually already known
+column_vector LogitLikelihood::gradient(const column_vector& parameters_in)
+   const
+{
+   const arma::vec parameters(const_cast<double*>(&parameters_in(0)), parameters_in.nr(), false, true);
+   evaluate(parameters);
+
+   column_vector gradient_out(cached_gradient.n_elem);
+   std::copy(cached_gradient.begin(), cached_gradient.end(), &gradient_out(0));
+   return gradient_out;
+}
+
+// Evaluates both the likelihood and gradient at parameters, unless they were
+// the last ones evaluated
+void LogitLikelihood::evaluate(const arma::vec& parameters)
+   const
+{
+   if (cached && cached_parameters.n_elem == parameters.n_elem
+         && std::equal(parameters.begin(), parameters.end(), cached_parameters.begin()))
+   {
+      return;
+   }
+   countLikelihoodEvaluation();
 
    // The objective function is the log-likelihood function (w is the parameters
    // vector for the model; y is the responses; x is the predictors; sig() is the
@@ -24,54 +59,42 @@ double LogitLikelihood::operator()(const column_vector& parameters_in)
    //   f(w) = sum(y log(sig(w'x)) + (1 - y) log(sig(1 - w'x))).
    // We want to minimize this function.  L2-regularization is just lambda
    // multiplied by the squared l2-norm of the parameters then divided by two.
+   //
+   // With eta = w'x this is sum(y eta - log(1 + exp(eta))), and the gradient
+   // is x'(y - sig(eta)). log(1 + exp(eta)) is taken as
+   // max(eta, 0) + log(1 + exp(-|eta|)), which neither overflows nor loses
+   // precision when sig(eta) is close to 0 or 1. The loop has no branches on
+   // y or the sign of eta, so can be vectorised
+   work = predictors * parameters;
 
-   // For the regularization, we ignore the first term, which is the intercept
-   // term.
-   double regularization = 0;
-   if (parameters.n_elem > 1 && lambda > 0)
-   {
-      regularization = 0.5 * lambda *
-       arma::dot(parameters.col(0).subvec(1, parameters.n_elem - 1),
-                 parameters.col(0).subvec(1, parameters.n_elem - 1));
-   }
-
-   // Calculate vectors of sigmoids
-   const arma::vec exponents = predictors * parameters;
-   const arma::vec sigmoid = 1.0 / (1.0 + arma::exp(-exponents));
-
-   // Assemble full objective function.
+   double* eta = work.memptr();
+   const double* y = responses.memptr();
    double result = 0.0;
-   for (size_t i = 0; i < responses.n_elem; ++i)
+   for (size_t i = 0; i < work.n_elem; ++i)
    {
-     if (responses[i] == 1)
-       result += log(sigmoid[i]);
-     else
-       result += log(1.0 - sigmoid[i]);
-   }
+      double exp_neg_abs = exp(-std::abs(eta[i]));
+      double log_one_plus = log1p(exp_neg_abs);
+      double sigmoid = (eta[i] >= 0 ? 1.0 : exp_neg_abs) / (1.0 + exp_neg_abs);
 
-   return result - regularization;
-}
+      result += y[i] * eta[i] - std::max(eta[i], 0.0) - log_one_plus;
+      eta[i] = y[i] - sigmoid; // residual, in place
+   }
 
-// Evaluate the gradient of the logistic regression objective function.
-column_vector LogitLikelihoodGradient::operator()(const column_vector& parameters_in)
-   const
-{
-   // Convert from dlib column matrix to armadillo column matrix
-   arma::vec parameters = dlib_to_arma(parameters_in);
-   arma::vec gradient(parameters.n_elem);
+   cached_gradient = predictors.t() * work;
 
-   // Regularization term.
-   arma::mat regularization(parameters.n_elem,1,arma::fill::zeros);
+   // For the regularization, we ignore the first term, which is the intercept
+   // term.
    if (parameters.n_elem > 1 && lambda > 0)
    {
-      regularization.col(0).subvec(1, parameters.n_elem - 1) =
-         lambda * parameters.col(0).subvec(1, parameters.n_elem - 1);
+      result -= 0.5 * lambda *
+       arma::dot(parameters.subvec(1, parameters.n_elem - 1),
+                 parameters.subvec(1, parameters.n_elem - 1));
+      cached_gradient.subvec(1, parameters.n_elem - 1) -=
+         lambda * parameters.subvec(1, parameters.n_elem - 1);
    }
 
-   const arma::vec sigmoids = 1 / (1 + arma::exp(- predictors * parameters));
-
-   gradient = predictors.t() * (responses - sigmoids) - regularization;
-
-   return arma_to_dlib(gradient);
+   cached = true;
+   cached_parameters = parameters;
+   cached_value = result;
 }
 
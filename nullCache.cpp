@@ -0,0 +1,184 @@
+/*
+ * File: nullCache.cpp
+ *
+ * Stores the null model fit of each bacterial variant, so that chunked jobs
+ * on the same input only fit them once
+ *
+ * Layout:
+ *    header   nullCacheHeader
+ *    records  one per unique bacterial pattern, in input order: bact_line
+ *             (int64), null_ll, num_coefficients coefficients, then the
+ *             num_coefficients^2 inverse information (double)
+ *
+ */
+
+#include "epistasis.hpp"
+
+#include <unistd.h>
+
+const char null_cache_magic[8] = {'E', 'P', 'I', 'N', 'U', 'L', 'L', '1'};
+const uint32_t null_cache_version = 4;
+
+struct nullCacheHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t num_coefficients;
+   uint64_t key;
+   uint64_t num_variants;
+};
+
+// 64-bit FNV-1a
+static void hashBytes(uint64_t& hash, const void* data, const size_t length)
+{
+   const unsigned char* bytes = static_cast<const unsigned char*>(data);
+   for (size_t i = 0; i < length; ++i)
+   {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+}
+
+static void hashFile(uint64_t& hash, const std::string& filename)
+{
+   hashBytes(hash, filename.data(), filename.size());
+
+   struct stat file_stat;
+   if (!filename.empty() && stat(filename.c_str(), &file_stat) == 0)
+   {
+      int64_t size = file_stat.st_size;
+      int64_t mtime = file_stat.st_mtime;
+      hashBytes(hash, &size, sizeof(size));
+      hashBytes(hash, &mtime, sizeof(mtime));
+   }
+}
+
+// Identifies the inputs and settings which the null fits depend on
+uint64_t nullCacheKey(const cmdOptions& parameters)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   hashBytes(hash, VERSION.data(), VERSION.size());
+   hashFile(hash, parameters.bact_file);
+   hashFile(hash, parameters.struct_file);
+   hashBytes(hash, &parameters.min_af, sizeof(parameters.min_af));
+   hashBytes(hash, &parameters.max_af, sizeof(parameters.max_af));
+   hashBytes(hash, &parameters.missing, sizeof(parameters.missing));
+   hashBytes(hash, &parameters.orthogonalise, sizeof(parameters.orthogonalise));
+
+   return hash;
+}
+
+// Whether the cache exists and its header matches this input. The records
+// are checked by readNullCache
+bool nullCacheMatches(const std::string& cache_file, const uint64_t key)
+{
+   std::ifstream cache_in(cache_file.c_str(), std::ios::binary);
+   nullCacheHeader header;
+   if (!cache_in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+   {
+      return false;
+   }
+
+   return memcmp(header.magic, null_cache_magic, sizeof(null_cache_magic)) == 0 && header.version == null_cache_version && header.key == key;
+}
+
+// Sets the null fits of all_bacteria from the cache. Returns false, leaving
+// them untouched, if the cache is missing or was made from different input
+bool readNullCache(const std::string& cache_file, const uint64_t key, std::vector<BacterialVariant>& all_bacteria)
+{
+   struct stat file_stat;
+   if (stat(cache_file.c_str(), &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(nullCacheHeader))
+   {
+      return false;
+   }
+
+   MappedFile cache_map(cache_file);
+   const nullCacheHeader* header = reinterpret_cast<const nullCacheHeader*>(cache_map.data());
+   const size_t num_coefficients = header->num_coefficients;
+   const size_t record_size = 2 + num_coefficients + num_coefficients * num_coefficients;
+   if (memcmp(header->magic, null_cache_magic, sizeof(null_cache_magic)) != 0 || header->version != null_cache_version
+         || header->key != key || header->num_variants != all_bacteria.size()
+         || cache_map.size() != sizeof(nullCacheHeader) + header->num_variants * record_size * sizeof(double))
+   {
+      std::cerr << "Null model cache " << cache_file << " does not match this input, ignoring it" << std::endl;
+      return false;
+   }
+
+   // Check every record lines up before using any of them
+   const double* records = reinterpret_cast<const double*>(cache_map.data() + sizeof(nullCacheHeader));
+   for (size_t i = 0; i < all_bacteria.size(); ++i)
+   {
+      int64_t bact_line;
+      memcpy(&bact_line, records + i * record_size, sizeof(bact_line));
+      if (bact_line != all_bacteria[i].line())
+      {
+         std::cerr << "Null model cache " << cache_file << " does not match this input, ignoring it" << std::endl;
+         return false;
+      }
+   }
+
+   for (size_t i = 0; i < all_bacteria.size(); ++i)
+   {
+      const double* record = records + i * record_size;
+      all_bacteria[i].null_ll(record[1]);
+      if (record[1] != 0)
+      {
+         all_bacteria[i].null_coefficients(arma::vec(record + 2, num_coefficients));
+      }
+
+      // An inverse information is positive definite, so a zero first
+      // element marks a record without one
+      const double* null_inverse = record + 2 + num_coefficients;
+      if (record[1] != 0 && null_inverse[0] != 0)
+      {
+         all_bacteria[i].null_inverse_information(arma::mat(null_inverse, num_coefficients, num_coefficients));
+      }
+   }
+
+   return true;
+}
+
+// Writes the null fits of all_bacteria. Written to a temporary file then
+// renamed, so concurrent jobs never read a partial cache
+void writeNullCache(const std::string& cache_file, const uint64_t key, const std::vector<BacterialVariant>& all_bacteria)
+{
+   nullCacheHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, null_cache_magic, sizeof(null_cache_magic));
+   header.version = null_cache_version;
+   header.key = key;
+   header.num_variants = all_bacteria.size();
+   for (auto it = all_bacteria.begin(); it != all_bacteria.end(); ++it)
+   {
+      header.num_coefficients = std::max(header.num_coefficients, (uint32_t)it->null_coefficients().n_elem);
+   }
+
+   std::string temp_file = cache_file + "." + std::to_string(getpid());
+   std::ofstream cache_out(temp_file.c_str(), std::ios::binary | std::ios::trunc);
+   cache_out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+   // Failed fits have no coefficients, and are padded with zeros
+   std::vector<double> record(2 + header.num_coefficients + header.num_coefficients * header.num_coefficients);
+   for (auto it = all_bacteria.begin(); it != all_bacteria.end(); ++it)
+   {
+      std::fill(record.begin(), record.end(), 0);
+      int64_t bact_line = it->line();
+      memcpy(record.data(), &bact_line, sizeof(bact_line));
+      record[1] = it->null_ll();
+      std::copy(it->null_coefficients().begin(), it->null_coefficients().end(), record.begin() + 2);
+      if (it->null_inverse_information().n_elem == (size_t)header.num_coefficients * header.num_coefficients)
+      {
+         std::copy(it->null_inverse_information().begin(), it->null_inverse_information().end(), record.begin() + 2 + header.num_coefficients);
+      }
+
+      cache_out.write(reinterpret_cast<const char*>(record.data()), record.size() * sizeof(double));
+   }
+   cache_out.close();
+
+   if (!cache_out || rename(temp_file.c_str(), cache_file.c_str()) != 0)
+   {
+      std::cerr << "WARNING: Could not write null model cache " << cache_file << std::endl;
+      remove(temp_file.c_str());
+   }
+}
+
@@ -0,0 +1,41 @@
+/*
+ * File: pairResult.cpp
+ *
+ * Printing of pair results
+ *
+ */
+
+#include "pairResult.hpp"
+
+const std::string pair_comment_default = "NA";
+const char* const pair_flag_names[] = {"fisher", "chi-large", "large-se", "bfgs-fail", "inv-fail", "nr-fail", "firth-fail", "zero-ll"};
+const int num_pair_flags = sizeof(pair_flag_names) / sizeof(pair_flag_names[0]);
+
+// Print fields tab sep, identical to input. Doesn't print newline
+std::ostream& operator<<(std::ostream &os, const PairResult& p)
+{
+   os << std::fixed << std::setprecision(3) << p.human_line << "\t" << p.bact_line
+      << "\t" << p.maf_x << "\t" << p.maf_y
+      << "\t" << std::scientific << p.chisq_p << "\t" << p.lrt_p
+      << "\t" << p.beta << "\t";
+
+   if (p.flags == 0)
+   {
+      os << pair_comment_default;
+   }
+   else
+   {
+      bool first = true;
+      for (int i = 0; i < num_pair_flags; ++i)
+      {
+         if (p.flags & (1u << i))
+         {
+            os << (first ? "" : ",") << pair_flag_names[i];
+            first = false;
+         }
+      }
+   }
+
+   return os;
+}
+
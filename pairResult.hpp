@@ -0,0 +1,49 @@
+/*
+ * pairResult.hpp
+ * Header file for PairResult struct
+ *
+ */
+
+// C/C++/C++11 headers
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdint>
+
+// Notes on how a pair was tested, printed in the comments column in this
+// order
+enum pairFlag : uint32_t
+{
+   flag_fisher = 1 << 0,
+   flag_chi_large = 1 << 1,
+   flag_large_se = 1 << 2,
+   flag_bfgs_fail = 1 << 3,
+   flag_inv_fail = 1 << 4,
+   flag_nr_fail = 1 << 5,
+   flag_firth_fail = 1 << 6,
+   flag_zero_ll = 1 << 7
+};
+
+// Outcome of testing one human variant against one bacterial variant. The
+// variants themselves are not held, only their line numbers and mafs
+struct PairResult
+{
+   long int human_line;
+   long int bact_line;
+   double maf_x;
+   double maf_y;
+   double null_ll;
+
+   double chisq_p;
+   double lrt_p;
+   double log_likelihood;
+   double beta;
+   double se;
+
+   uint32_t flags;
+   bool firth;
+};
+
+// Overload output operator
+std::ostream& operator<<(std::ostream &os, const PairResult& p);
+
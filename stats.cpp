@@ -9,160 +9,349 @@
 
 const double normalArea = pow(2*M_PI, -0.5);
 
-// Basic chi^2 test, using contingency table
-double chiTest(Pair& p)
+// Count the contingency table for a pair
+contingencyTable countTable(const HumanVariant& human, const BacterialVariant& bact)
 {
-   arma::mat x = p.get_x();
-   arma::vec y = p.get_y();
-
    // Contigency table
    //          human 0   human 1   human 2
    // bact 0   a         b         c
    // bact 1   d         e         f
    //
-   // Use doubles for compatibility with det function in arma::mat
-   double a = 0, b = 0, c = 0, d = 0, e = 0, f = 0;
+   // Missing values in either are counted as 0, as in the regression.
+   // Only e and f need counting per pair, with AND and popcount on the
+   // packed planes. The rest follow from the per-variant totals
+   contingencyTable table;
+   table.e = andPopcountPlanes(bact.y_plane(), human.het_plane());
+   table.f = andPopcountPlanes(bact.y_plane(), human.hom_plane());
+   table.d = bact.y_count() - table.e - table.f;
+   table.b = human.het_count() - table.e;
+   table.c = human.hom_count() - table.f;
+   table.a = bact.size() - bact.y_count() - table.b - table.c;
+
+   return table;
+}
+
+tableKey tableCacheKey(const contingencyTable& table)
+{
+   tableKey key = {{table.a, table.b, table.c, table.d, table.e, table.f}};
+   return key;
+}
 
-   arma::vec::const_iterator j = y.begin();
-   for (arma::vec::const_iterator i = x.begin(); i!=x.end(); ++i)
+// Replaces the p-value of a sparse table with Fisher's exact test
+static void fisherTest(tableTest& result, TableCache<double>& fisher_cache)
+{
+   // Sparse tables repeat often, so are cached
+   const contingencyTable& table = result.table;
+   tableKey key = tableCacheKey(table);
+   if (!fisher_cache.find(key, result.p_value))
    {
-      if (*j == 0) {
-         if (*i == 0){
-            a++;
-         } else if (*i == 1){
-            b++;
-         } else {
-            c++;
-         }
-      } else {
-         if (*i == 0){
-            d++;
-         } else if (*i == 1){
-            e++;
-         } else {
-            f++;
-         }
-      }
-      j++;
+      result.p_value = fisher23(table.a, table.b, table.c, table.d, table.e, table.f, 1);
+      fisher_cache.insert(key, result.p_value);
    }
+   result.fisher = true;
+}
 
-   // This is done row-wise
-   arma::mat::fixed<2, 3> table = {a, d, b, e, c, f};
-#ifdef EPISTASIS_DEBUG
-   arma::Mat<int>::fixed<2, 3> tab_out = {int (a), int (d), int (b), int(e), int(c), int(f)};
-   std::cerr << tab_out << "\n";
-#endif
-
-   int N = accu(table);
+// Basic chi^2 test, run over a tile of contingency tables at once
+// Tables with low counts are flagged as sparse, needing Firth regression,
+// and are tested with Fisher's exact test instead unless fisher_p is false
+void chiTest(const std::vector<contingencyTable>& tables, std::vector<tableTest>& results, TableCache<double>& fisher_cache, const bool fisher_p)
+{
+   results.resize(tables.size());
 
-   if (N == 0)
+   // First pass has no branches, so is vectorised over the tile. Tables
+   // with empty rows or columns get a nonsense statistic here, but are
+   // always sent to Fisher's test below
+   for (size_t i = 0; i < tables.size(); ++i)
    {
-      throw std::logic_error("Empty table for chisq test\n");
+      const double a = tables[i].a, b = tables[i].b, c = tables[i].c;
+      const double d = tables[i].d, e = tables[i].e, f = tables[i].f;
+
+      const double total = a + b + c + d + e + f; // should equal sample size
+      const double row_0 = a + b + c, row_1 = d + e + f;
+      const double col_0 = a + d, col_1 = b + e, col_2 = c + f;
+
+      double chisq = 0;
+      double expected;
+      expected = row_0 * col_0 / total; chisq += (a - expected) * (a - expected) / expected;
+      expected = row_0 * col_1 / total; chisq += (b - expected) * (b - expected) / expected;
+      expected = row_0 * col_2 / total; chisq += (c - expected) * (c - expected) / expected;
+      expected = row_1 * col_0 / total; chisq += (d - expected) * (d - expected) / expected;
+      expected = row_1 * col_1 / total; chisq += (e - expected) * (e - expected) / expected;
+      expected = row_1 * col_2 / total; chisq += (f - expected) * (f - expected) / expected;
+
+      // The chi^2 cdf with 2 degrees of freedom is 1 - exp(-x/2). p is taken
+      // as 1 - cdf so that it reaches zero at the same point it always has
+      results[i].table = tables[i];
+      results[i].statistic = chisq;
+      results[i].p_value = 1 - (-std::expm1(-0.5 * chisq));
+      results[i].sparse = false;
+      results[i].fisher = false;
+      results[i].chi_large = false;
    }
 
-   // Treat as invalid if any entry is 0 or 1, or if more than one entry < 5
-   // Mark as needing to use Firth regression and use Fisher's exact test
-   int low_obs = 0;
-   double p_value = 0;
-   for (auto obs = table.begin(); obs != table.end(); ++obs)
+   for (size_t i = 0; i < tables.size(); ++i)
    {
-      if (*obs <= 1 || (*obs <= 5 && ++low_obs > 2))
+      const contingencyTable& table = tables[i];
+#ifdef EPISTASIS_DEBUG
+      std::cerr << table.a << "\t" << table.b << "\t" << table.c << "\n"
+                << table.d << "\t" << table.e << "\t" << table.f << "\n";
+#endif
+      if (table.a + table.b + table.c + table.d + table.e + table.f == 0)
       {
-         p_value = fisher23(int (a), int (b), int (c), int(d), int (e), int(f), 1);
-         p.add_comment("fisher");
-         p.firth(1);
-         break;
+         throw std::logic_error("Empty table for chisq test\n");
       }
-   }
-
-   // Use chi^2 test if table was ok
-   if (!p.firth())
-   {
-      double chisq = 0;
 
-      double total = accu(table); // should equal sample size
-      arma::rowvec col_sum = sum(table, 0);
-      arma::colvec row_sum = sum(table, 1);
-
-      for (int i = 0; i < 2; ++i)
+      // Treat as invalid if any entry is 0 or 1, or if more than two entries
+      // are <= 5
+      // Mark as needing to use Firth regression
+      const uint32_t cells[6] = {table.a, table.d, table.b, table.e, table.c, table.f};
+      int low_obs = 0;
+      bool sparse = false;
+      for (int j = 0; j < 6; ++j)
       {
-         for (int j = 0; j < 3; j++)
+         if (cells[j] <= 1 || (cells[j] <= 5 && ++low_obs > 2))
          {
-            double expected = row_sum(i) * col_sum(j) / total;
-            chisq += pow(table(i,j) - expected, 2) / expected;
+            sparse = true;
+            break;
          }
       }
 
-      try
+      if (sparse)
       {
-         boost::math::chi_squared chi_dist(2);
-         p_value = 1 - boost::math::cdf(chi_dist, chisq);
-
-         if (p_value == 0)
+         results[i].sparse = true;
+         if (fisher_p)
          {
-            p_value = normalPval(pow(chisq, 0.5));
-            p.add_comment("chi-large");
+            fisherTest(results[i], fisher_cache);
          }
+      }
+      else if (results[i].p_value == 0)
+      {
+         results[i].p_value = normalPval(pow(results[i].statistic, 0.5));
+         results[i].chi_large = true;
+      }
 #ifdef EPISTASIS_DEBUG
-         std::cerr << "chisq:" << chisq << "\n";
-         std::cerr << "chisq p: " << p_value << "\n";
+      std::cerr << "chisq:" << results[i].statistic << "\n";
+      std::cerr << "chisq p: " << results[i].p_value << "\n";
 #endif
+   }
+}
+
+// Null model terms used by the score screen, which depend only on the
+// bacterial variant so are made once after the null fits. Variants whose
+// null model could not be fitted are left as zero columns
+std::shared_ptr<const scoreTerms> nullScoreTerms(const std::vector<BacterialVariant>& all_bacteria, ThreadPool& pool)
+{
+   auto terms = std::make_shared<scoreTerms>();
+   if (all_bacteria.empty())
+   {
+      return terms;
+   }
+
+   designMatrix(arma::mat(), all_bacteria[0], terms->x_null);
+   terms->residuals.zeros(terms->x_null.n_rows, all_bacteria.size());
+   terms->weights.zeros(terms->x_null.n_rows, all_bacteria.size());
+
+   pool.parallel_for(all_bacteria.size(), pair_block_size,
+      [&](size_t start, size_t end, unsigned int thread_id)
+      {
+         arma::vec y, probs;
+         for (size_t i = start; i < end; ++i)
+         {
+            if (all_bacteria[i].null_inverse_information().n_elem == 0)
+            {
+               continue;
+            }
+
+            probs = terms->x_null * all_bacteria[i].null_coefficients();
+            probs = 1 / (1 + arma::exp(-probs));
+            all_bacteria[i].get_y(y);
+            terms->residuals.col(i) = y - probs;
+            terms->weights.col(i) = probs % (1 - probs);
+         }
+      });
+
+   return terms;
+}
+
+// Score test of adding each human variant in the block to the null model of
+// each bacterial variant in [start, end). Unlike the chi^2 test this
+// accounts for the covariates. With the null fit's residuals r, weights w
+// and design matrix Z = [1 | covars], the statistic for human genotypes x is
+//    (x'r)^2 / (x'Wx - x'WZ (Z'WZ)^-1 Z'Wx)
+// which is chi^2 with one degree of freedom. Only the products with x are
+// done here, for the whole tile as matrix products. Replaces the p-values in
+// results, which are ordered as in screenBlock. Bacterial variants whose
+// null model could not be fitted keep their chi^2 p-values
+void scoreTest(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, const std::vector<BacterialVariant>& all_bacteria, const scoreTerms& terms, const size_t start, const size_t end, std::vector<tableTest>& results)
+{
+   const size_t block_size = human_block.size();
+   const size_t num_null = terms.x_null.n_cols;
+
+   arma::mat genotypes(terms.x_null.n_rows, block_size);
+   for (size_t h = 0; h < block_size; ++h)
+   {
+      genotypes.col(h) = human_block[h]->genotypes();
+   }
+
+   // Each of these is bacteria x human
+   const arma::mat weights = terms.weights.cols(start, end - 1);
+   arma::mat score = terms.residuals.cols(start, end - 1).t() * genotypes;
+   arma::mat information = weights.t() * arma::square(genotypes);
+   std::vector<arma::mat> cross_information(num_null);
+   for (size_t j = 0; j < num_null; ++j)
+   {
+      cross_information[j] = weights.t() * (genotypes.each_col() % terms.x_null.col(j));
+   }
+
+   arma::vec cross(num_null);
+   for (size_t i = start; i < end; ++i)
+   {
+      const arma::mat& null_inverse = all_bacteria[i].null_inverse_information();
+      if (null_inverse.n_elem == 0)
+      {
+         continue;
       }
-      catch (std::exception& e)
+
+      const size_t k = i - start;
+      for (size_t h = 0; h < block_size; ++h)
       {
-         std::cerr << "Caught error: " << e.what() << std::endl;
-         std::cerr << "Could not do chisq test on lines: " << p.bact_line() << "," << p.human_line() << std::endl;
+         for (size_t j = 0; j < num_null; ++j)
+         {
+            cross(j) = cross_information[j](k,h);
+         }
+
+         // A human variant explained by the covariates gives no information
+         tableTest& result = results[k * block_size + h];
+         double variance = information(k,h) - dot(cross, null_inverse * cross);
+         result.statistic = variance > 0 ? score(k,h) * score(k,h) / variance : 0;
+         result.p_value = normalPval(pow(result.statistic, 0.5));
+         result.fisher = false;
+         result.chi_large = false;
       }
    }
+}
+
+// Screening stage. Tests a block of human variants against all bacterial
+// variants, one tile of bacteria at a time so the human planes stay in
+// cache. Results are bacteria-major: screen[bact_idx * block size + human_idx]
+// The tables are always counted, as they decide which pairs need Firth
+// regression and are used to fit pairs without covariates. Pairs are given
+// the score test instead if score_terms is set
+void screenBlock(const std::vector<std::shared_ptr<const HumanVariant>>& human_block, const std::vector<BacterialVariant>& all_bacteria, const std::shared_ptr<const scoreTerms>& score_terms, std::vector<tableTest>& screen, TableCache<double>& fisher_cache, ThreadPool& pool)
+{
+   const size_t block_size = human_block.size();
+   screen.resize(all_bacteria.size() * block_size);
+
+   pool.parallel_for(all_bacteria.size(), pair_block_size,
+      [&](size_t start, size_t end, unsigned int thread_id)
+      {
+         std::vector<contingencyTable> tables;
+         tables.reserve((end - start) * block_size);
+         for (size_t i = start; i < end; ++i)
+         {
+            for (auto human = human_block.begin(); human != human_block.end(); ++human)
+            {
+               tables.push_back(countTable(**human, all_bacteria[i]));
+            }
+         }
 
-   return p_value;
+         // The score test replaces the p-values of every bacterial variant
+         // with a null fit, so Fisher's test is only needed for the others
+         std::vector<tableTest> results;
+         chiTest(tables, results, fisher_cache, !score_terms);
+         if (score_terms)
+         {
+            scoreTest(human_block, all_bacteria, *score_terms, start, end, results);
+            for (size_t i = start; i < end; ++i)
+            {
+               if (all_bacteria[i].null_inverse_information().n_elem > 0)
+               {
+                  continue;
+               }
+
+               for (size_t h = 0; h < block_size; ++h)
+               {
+                  tableTest& result = results[(i - start) * block_size + h];
+                  if (result.sparse)
+                  {
+                     fisherTest(result, fisher_cache);
+                  }
+               }
+            }
+         }
+         std::copy(results.begin(), results.end(), screen.begin() + start * block_size);
+      });
 }
 
-// Fit null models for null log-likelihoods
-void set_null_ll(Pair& p)
+// Inverse of the information Z'WZ of the null model with design matrix Z at
+// its fitted coefficients. Empty if this is singular
+static arma::mat nullInverseInformation(const arma::mat& x_null, const arma::vec& coefficients)
 {
-   double null_ll = 0;
+   arma::vec weights = 1 / (1 + arma::exp(-(x_null * coefficients)));
+   weights = weights % (1 - weights);
 
-   arma::vec y = p.get_y();
-   if (p.covars_set())
+   arma::mat null_inverse;
+   if (!inv_sympd(null_inverse, arma::mat(x_null.t() * (x_null.each_col() % weights))))
    {
-      Pair null_pair(p.size());
+      null_inverse.reset();
+   }
+   return null_inverse;
+}
 
-      null_pair.add_x(p.get_covars());
-      null_pair.add_y(y);
+// Fit null models for null log-likelihoods. The inverse information of the
+// fit is kept too, for the score screen and as the start of the pair fits
+void set_null_ll(BacterialVariant& bact)
+{
+   double null_ll = 0;
+   arma::vec coefficients;
 
-      doLogit(null_pair);
-      null_ll = null_pair.log_likelihood();
+   arma::vec y;
+   arma::mat x_design;
+   bact.get_y(y);
+   if (bact.covars_set())
+   {
+      designMatrix(arma::mat(), bact, x_design);
+
+      PairResult null_fit = PairResult();
+      null_fit.bact_line = bact.line();
+      doLogit(null_fit, y, x_design, coefficients);
+      null_ll = null_fit.log_likelihood;
       if (null_ll == 0)
       {
-         std::cerr << "Could not find null log-likelihood for bacterial line " << p.bact_line() << std::endl;
+         std::cerr << "Could not find null log-likelihood for bacterial line " << bact.line() << std::endl;
       }
    }
    else
    {
       // intercept only
-      arma::mat x_intercept(p.size(), 1, arma::fill::ones);
+      x_design.ones(bact.size(), 1);
 
-      dlib::matrix<double,1,1> intercept;
+      arma::vec intercept(1);
       intercept(0) = log(mean(y)/(1-mean(y))); // null is: intercept = log-odds of success
 
-      LogitLikelihood likelihood_fit(x_intercept, y);
+      LogitLikelihood likelihood_fit(x_design, y);
       null_ll = likelihood_fit(intercept);
+      coefficients = intercept;
    }
 
-   p.null_ll(null_ll);
+   bact.null_ll(null_ll);
+   bact.null_coefficients(coefficients);
+   if (coefficients.n_elem == x_design.n_cols)
+   {
+      bact.null_inverse_information(nullInverseInformation(x_design, coefficients));
+   }
 }
 
 // Likelihood-ratio test
-double likelihoodRatioTest(Pair& p)
+double likelihoodRatioTest(PairResult& p)
 {
-   double log_likelihood = p.log_likelihood();
-   double null_ll = p.null_ll();
+   double log_likelihood = p.log_likelihood;
+   double null_ll = p.null_ll;
    double lrt_p = 1;
    if (log_likelihood == 0 || null_ll == 0)
    {
-      p.add_comment("zero-ll");
-      lrt_p = p.p_val(); // Use the Wald test p-value otherwise
+      p.flags |= flag_zero_ll;
+      lrt_p = p.lrt_p; // Use the Wald test p-value otherwise
    }
    else
    {
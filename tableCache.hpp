@@ -0,0 +1,135 @@
+/*
+ * tableCache.hpp
+ * Header file for TableCache class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+// The six counts of a contingency table, in the order a, b, c, d, e, f
+typedef std::array<uint32_t, 6> tableKey;
+
+struct tableKeyHash
+{
+   size_t operator()(const tableKey& key) const
+   {
+      uint64_t hash = 14695981039346656037ULL;
+      for (size_t i = 0; i < key.size(); ++i)
+      {
+         hash = (hash ^ key[i]) * 1099511628211ULL;
+      }
+      return hash ^ (hash >> 32);
+   }
+};
+
+// Results computed from a contingency table alone, shared between threads.
+// Split into shards with their own lock so threads rarely wait for each
+// other. Each shard holds a fixed number of entries, replacing the oldest
+// when full
+template <class Value>
+class TableCache
+{
+   public:
+      // Initialisation
+      TableCache(size_t max_entries)
+         :_shards(new Shard[num_shards])
+      {
+         size_t shard_entries = std::max(max_entries / num_shards, (size_t)1);
+         for (size_t i = 0; i < num_shards; ++i)
+         {
+            _shards[i].capacity = shard_entries;
+            _shards[i].next = 0;
+            _shards[i].hits = 0;
+            _shards[i].misses = 0;
+         }
+      }
+
+      TableCache(const TableCache&) = delete;
+      TableCache& operator=(const TableCache&) = delete;
+
+      // Returns whether key is cached, setting value if so
+      bool find(const tableKey& key, Value& value)
+      {
+         Shard& shard = shard_for(key);
+         std::lock_guard<std::mutex> lock(shard.mutex);
+
+         auto it = shard.entries.find(key);
+         if (it == shard.entries.end())
+         {
+            shard.misses++;
+            return false;
+         }
+
+         shard.hits++;
+         value = it->second;
+         return true;
+      }
+
+      void insert(const tableKey& key, const Value& value)
+      {
+         Shard& shard = shard_for(key);
+         std::lock_guard<std::mutex> lock(shard.mutex);
+
+         if (shard.entries.count(key))
+         {
+            return;
+         }
+
+         if (shard.order.size() < shard.capacity)
+         {
+            shard.order.push_back(key);
+         }
+         else
+         {
+            shard.entries.erase(shard.order[shard.next]);
+            shard.order[shard.next] = key;
+            shard.next = (shard.next + 1) % shard.capacity;
+         }
+         shard.entries.emplace(key, value);
+      }
+
+      // nonmodifying operations. Only accurate once all threads have finished
+      uint64_t hits() const { return sum_counts(&Shard::hits); }
+      uint64_t misses() const { return sum_counts(&Shard::misses); }
+
+   private:
+      static const size_t num_shards = 64;
+
+      struct Shard
+      {
+         std::mutex mutex;
+         std::unordered_map<tableKey, Value, tableKeyHash> entries;
+         std::vector<tableKey> order;
+         size_t capacity;
+         size_t next;
+         uint64_t hits;
+         uint64_t misses;
+      };
+
+      Shard& shard_for(const tableKey& key)
+      {
+         return _shards[(tableKeyHash()(key) >> 7) % num_shards];
+      }
+
+      uint64_t sum_counts(uint64_t Shard::* count) const
+      {
+         uint64_t total = 0;
+         for (size_t i = 0; i < num_shards; ++i)
+         {
+            std::lock_guard<std::mutex> lock(_shards[i].mutex);
+            total += _shards[i].*count;
+         }
+         return total;
+      }
+
+      std::unique_ptr<Shard[]> _shards;
+};
+
@@ -0,0 +1,145 @@
+/*
+ * File: threadPool.cpp
+ *
+ * Persistent worker threads which share out blocks of work, stealing blocks
+ * from each other when their own share runs out
+ *
+ */
+
+#include "threadPool.hpp"
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+   :_num_threads(num_threads), _generation(0), _running(0), _stop(false), _task(nullptr), _num_items(0), _block_size(1)
+{
+   if (_num_threads < 1)
+   {
+      _num_threads = 1;
+   }
+   _ranges.reset(new BlockRange[_num_threads]);
+
+   // Calling thread acts as thread 0
+   for (unsigned int i = 1; i < _num_threads; ++i)
+   {
+      _workers.push_back(std::thread(&ThreadPool::worker, this, i));
+   }
+}
+
+ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+   }
+   _job_ready.notify_all();
+
+   for (auto it = _workers.begin(); it != _workers.end(); ++it)
+   {
+      it->join();
+   }
+}
+
+void ThreadPool::parallel_for(size_t num_items, size_t block_size, const std::function<void(size_t, size_t, unsigned int)>& task)
+{
+   if (num_items == 0)
+   {
+      return;
+   }
+   if (block_size < 1)
+   {
+      block_size = 1;
+   }
+
+   // Single threaded runs avoid any synchronisation
+   if (_num_threads == 1)
+   {
+      for (size_t start = 0; start < num_items; start += block_size)
+      {
+         task(start, std::min(start + block_size, num_items), 0);
+      }
+      return;
+   }
+
+   // Give each thread an equal contiguous share of the blocks
+   size_t num_blocks = (num_items + block_size - 1) / block_size;
+   for (unsigned int i = 0; i < _num_threads; ++i)
+   {
+      _ranges[i].next.store(num_blocks * i / _num_threads);
+      _ranges[i].end = num_blocks * (i + 1) / _num_threads;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _task = &task;
+      _num_items = num_items;
+      _block_size = block_size;
+      _error = nullptr;
+      _running = _num_threads - 1;
+      _generation++;
+   }
+   _job_ready.notify_all();
+
+   run_blocks(0);
+
+   std::unique_lock<std::mutex> lock(_mutex);
+   _job_done.wait(lock, [this]{ return _running == 0; });
+   _task = nullptr;
+
+   if (_error)
+   {
+      std::exception_ptr error = _error;
+      _error = nullptr;
+      std::rethrow_exception(error);
+   }
+}
+
+void ThreadPool::worker(unsigned int thread_id)
+{
+   unsigned long seen_generation = 0;
+   while (true)
+   {
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         _job_ready.wait(lock, [this, seen_generation]{ return _stop || _generation != seen_generation; });
+         if (_stop)
+         {
+            return;
+         }
+         seen_generation = _generation;
+      }
+
+      run_blocks(thread_id);
+
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _running--;
+      }
+      _job_done.notify_one();
+   }
+}
+
+// Work through own range first, then visit the other ranges in turn
+void ThreadPool::run_blocks(unsigned int thread_id)
+{
+   try
+   {
+      for (unsigned int offset = 0; offset < _num_threads; ++offset)
+      {
+         BlockRange& range = _ranges[(thread_id + offset) % _num_threads];
+
+         size_t block;
+         while ((block = range.next.fetch_add(1)) < range.end)
+         {
+            size_t start = block * _block_size;
+            (*_task)(start, std::min(start + _block_size, _num_items), thread_id);
+         }
+      }
+   }
+   catch (...)
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_error)
+      {
+         _error = std::current_exception();
+      }
+   }
+}
@@ -0,0 +1,65 @@
+/*
+ * threadPool.hpp
+ * Header file for ThreadPool class
+ *
+ */
+
+// C/C++/C++11 headers
+#include <cstdlib>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+
+// Work is split into blocks of consecutive items. Each thread starts on its
+// own contiguous range of blocks, and once that is exhausted steals blocks
+// from the ranges of the other threads
+class ThreadPool
+{
+   public:
+      // Initialisation
+      ThreadPool(unsigned int num_threads);
+      ~ThreadPool();
+
+      ThreadPool(const ThreadPool&) = delete;
+      ThreadPool& operator=(const ThreadPool&) = delete;
+
+      // nonmodifying operations
+      unsigned int size() const { return _num_threads; }
+
+      // Runs task(start, end, thread_id) over [0, num_items) in blocks, and
+      // returns when all blocks are done. The calling thread is thread 0.
+      // The first exception thrown by a task is rethrown here
+      void parallel_for(size_t num_items, size_t block_size, const std::function<void(size_t, size_t, unsigned int)>& task);
+
+   private:
+      struct BlockRange
+      {
+         std::atomic<size_t> next;
+         size_t end;
+      };
+
+      void worker(unsigned int thread_id);
+      void run_blocks(unsigned int thread_id);
+
+      unsigned int _num_threads;
+      std::vector<std::thread> _workers;
+
+      std::mutex _mutex;
+      std::condition_variable _job_ready;
+      std::condition_variable _job_done;
+      unsigned long _generation;
+      unsigned int _running;
+      bool _stop;
+
+      const std::function<void(size_t, size_t, unsigned int)>* _task;
+      size_t _num_items;
+      size_t _block_size;
+      std::unique_ptr<BlockRange[]> _ranges;
+      std::exception_ptr _error;
+};